@@ -0,0 +1,58 @@
+#ifndef BOUNDARYSDF_H
+#define BOUNDARYSDF_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+#include "TriangleBVH.h"
+#include "TriangleMesh.h"
+
+//Static boundary as a signed distance field sampled at voxel centers, positive on the side the triangles face
+class BoundarySDF{
+public:
+    static constexpr int resolution = 64;
+    static constexpr int brickSize = 4; //voxels per edge that share one BVH query
+
+    //Loads the field from cacheFile if it was baked from the same mesh and bounds, otherwise bakes and stores it, an empty cacheFile always bakes
+    void build(ThreadPool* threadPool, const TriangleMesh& mesh, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const std::string& cacheFile);
+
+    //Per voxel (normal pointing away from the boundary, signed distance), x fastest
+    const std::vector<glm::vec4>& getSamples();
+    glm::vec3 getOrigin();
+    glm::vec3 getExtent();
+private:
+    struct CacheHeader{
+        char magic[4];
+        int32_t resolution;
+        uint64_t meshHash;
+        glm::vec3 origin;
+        glm::vec3 extent;
+    };
+
+    std::vector<glm::vec4> samples;
+    glm::vec3 origin, extent;
+
+    //Angle weighted pseudo normals decide the sign wherever the closest point is an edge or a vertex
+    const TriangleMesh* _mesh;
+    std::vector<glm::vec3> faceNormals;
+    std::vector<glm::vec3> vertexNormals;
+    std::map<std::pair<uint32_t, uint32_t>, glm::vec3> edgeNormals;
+
+    void computePseudoNormals();
+    glm::vec4 evaluate(const glm::vec3& point, const NearestHit& hit);
+    bool loadCache(const std::string& cacheFile, const CacheHeader& expected);
+    void storeCache(const std::string& cacheFile, const CacheHeader& header);
+};
+
+#endif
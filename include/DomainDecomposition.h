@@ -0,0 +1,53 @@
+#ifndef DOMAIN_DECOMPOSITION_H
+#define DOMAIN_DECOMPOSITION_H
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "Solver.h"
+#include "Transport.h"
+
+//Splits the domain into slabs along x, one per rank. Before every fixed step each rank hands particles that left its slab
+//to their new owner and sends copies of everything within the halo of another slab, the solver only moves owned particles.
+class DomainDecomposition{
+public:
+    static constexpr int histogramBins = 256;
+    static constexpr int rebalanceInterval = 120; //steps
+    static constexpr int reportInterval = 300; //steps
+
+    void init(Transport* transport, SPH* solver);
+    void step();
+    void cleanup();
+
+    //False once a peer went away, the remaining ranks keep their last state and should shut down
+    bool isRunning();
+private:
+    Transport* transport;
+    SPH* solver;
+    int rank;
+    int size;
+    std::vector<int> peers;
+
+    //Slab r covers [cuts[r], cuts[r + 1])
+    std::vector<float> cuts;
+    std::vector<particle> particles;
+    std::vector<std::vector<char>> outgoing, incoming;
+    int ownedCount = 0;
+    int steps = 0;
+    bool distributed = false;
+    bool running = true;
+
+    void distribute();
+    void exchangeParticles();
+    void rebalance();
+    bool exchange();
+    int getOwner(float x);
+    float getHaloWidth();
+
+    static void append(std::vector<char>& message, const particle& p);
+};
+
+#endif
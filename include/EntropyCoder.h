@@ -0,0 +1,42 @@
+#ifndef ENTROPY_CODER_H
+#define ENTROPY_CODER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/* Entropy coder for chunks of small unsigned integers, such as zigzagged deltas. Every value is split into its bit
+   length (0 to 32), which is coded with a static rANS model built per chunk, and the bits below its leading one,
+   which are stored raw. Chunks carry their own model and decode on their own, so they can be coded in parallel.
+
+   Chunk layout: uint16 frequencies[symbolCount] (summing to 1 << probabilityBits), uint32 rANS bytes, uint32 raw
+   bytes, the rANS stream, the raw bit stream (least significant bit first).                                    */
+class EntropyCoder{
+public:
+    static constexpr int symbolCount = 33;
+    static constexpr int probabilityBits = 12;
+
+    //Appends the coded chunk to out
+    static void encode(const uint32_t* values, size_t count, std::vector<uint8_t>& out);
+
+    //count has to match what was encoded, throws on malformed input
+    static void decode(const uint8_t* data, size_t size, uint32_t* values, size_t count);
+
+    static uint32_t zigzag(int32_t value){
+        return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+    }
+
+    static int32_t unzigzag(uint32_t value){
+        return int32_t(value >> 1) ^ -int32_t(value & 1);
+    }
+private:
+    static constexpr uint32_t ransLow = 1u << 23;
+
+    static int bitLength(uint32_t value);
+    static void normalizeFrequencies(const uint32_t* counts, uint16_t* frequencies);
+};
+
+#endif
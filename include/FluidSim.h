@@ -2,25 +2,110 @@
 #define FLUIDSIM_H
 
 #include <chrono>
+#include <string>
 
+#include "DomainDecomposition.h"
+#include "FramePublisher.h"
+#include "ParticleExporter.h"
+#include "RegressionHarness.h"
 #include "Solver.h"
 #include "Renderer.h"
+#include "Trace.h"
+#include "Trajectory.h"
+#include "TrajectoryPlayer.h"
+#include "SurfaceExtractor.h"
+#include "ThreadPool.h"
+#include "Transport.h"
 #include "Window.h"
 
 const unsigned int WIDTH = 800;
 const unsigned int HEIGHT = 600;
+const unsigned int SURFACE_INTERVAL = 5; //frames between CPU surface extractions in mesh mode
+const unsigned int THREAD_STATS_INTERVAL = 300; //frames between thread pool utilization reports
+const int INFLOW_CAPACITY = 65536;
+const int ADAPTIVE_CAPACITY = 16384;
+const int REGRESSION_STEPS = 600;
+const double PERFORMANCE_TOLERANCE = 0.1;
+const double PHYSICS_TOLERANCE = 0.001;
+const int PUBLISH_SLOTS = 4; //frames kept in the shared memory ring for readers
+const float TRAJECTORY_ERROR = 0.0001f; //position error bound relative to the domain extent
+const int TRAJECTORY_KEYFRAMES = 60; //frames between trajectory keyframes
+const unsigned int EXPORT_ATTRIBUTES = EXPORT_POSITION | EXPORT_VELOCITY | EXPORT_DENSITY;
+
+enum HarnessMode {HARNESS_OFF, HARNESS_RECORD, HARNESS_COMPARE};
 
 class FluidSim {
 public:
+    void parseArguments(int argc, char** argv);
     void run();
 private:
     SPH solver;
     Window window;
     Renderer renderer;
+    ThreadPool threadPool;
+    SurfaceExtractor surfaceExtractor;
+
+    //Each rank is a forked process owning one slab of the domain
+    int ranks = 1;
+    UnixSocketTransport transport;
+    DomainDecomposition decomposition;
+
+    //Regression runs replace the interactive loop, scene holds the options that shape the simulation
+    HarnessMode harnessMode = HARNESS_OFF;
+    RegressionHarness harness;
+    std::string harnessFile;
+    std::string reportFile;
+    std::string scene;
+    int harnessSteps = REGRESSION_STEPS;
+    double performanceTolerance = PERFORMANCE_TOLERANCE;
+    double physicsTolerance = PHYSICS_TOLERANCE;
+
+    //Parameter sets from --params, P switches to the next one and starts the scene over. With --ensemble they all
+    //run at once and P only picks the scene the surface is extracted from.
+    std::vector<SimParams> paramSets;
+    std::vector<std::string> paramFiles;
+    size_t currentParams = 0;
+    bool ensemble = false;
+
+    //Completed frames go to a shared memory ring for external readers, see FrameRing.h
+    std::string publishName;
+    FramePublisher publisher;
+
+    //Every frame's positions go to a compressed trajectory, see Trajectory.h
+    std::string trajectoryFile;
+    float trajectoryError = TRAJECTORY_ERROR;
+    TrajectoryWriter trajectory;
+    std::vector<glm::vec3> trajectoryPositions;
+    double recordedTime = -1.0; //simulated time of the last frame published and recorded
+
+    //Chrome trace of CPU zones and GPU spans written on exit, needs a build with FLUIDSIM_TRACE
+    std::string traceFile;
+
+    //--replay draws a recorded trajectory instead of stepping the solver
+    std::string replayFile;
+    TrajectoryPlayer player;
+
+    //Particle exports from --export, on E and every exportInterval frames when that is set
+    bool exporting = false;
+    ExportFormat exportFormat = EXPORT_VTU;
+    unsigned int exportAttributes = EXPORT_ATTRIBUTES;
+    unsigned int exportInterval = 0;
+    ParticleExporter exporter;
+
+    std::vector<particle> particleCache;
+    unsigned int frame = 0;
+    bool threadStats = false;
 
     void init();
     void mainLoop();
+    void runHarness();
+    void replayLoop();
+    void uploadReplayFrame(const ReplayFrame& replayFrame);
     void cleanup();
+    void extractSurface(int scene);
+    void exportSurfaces();
+    void exportParticles();
+    void applyParams(size_t index);
 };
 
 #endif
\ No newline at end of file
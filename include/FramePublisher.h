@@ -0,0 +1,39 @@
+#ifndef FRAME_PUBLISHER_H
+#define FRAME_PUBLISHER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "FrameRing.h"
+#include "Solver.h"
+#include "Trace.h"
+
+//Producer side of the shared memory frame ring, see FrameRing.h for the layout and the protocol
+class FramePublisher{
+public:
+    //name is a POSIX shared memory name, a leading slash is added when missing; capacity bounds the particles per frame
+    void init(const std::string& name, int capacity, int slotCount);
+    void cleanup();
+
+    //Never waits for readers, a reader still copying the slot this overwrites notices and drops the frame
+    void publish(const std::vector<particle>& particles, float time);
+
+    uint64_t getFrameCount();
+private:
+    std::string name;
+    FrameRingHeader* header = nullptr;
+    size_t mappedBytes = 0;
+    uint64_t frame = 0;
+
+    FrameSlotHeader* getSlot(uint64_t frame);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+/* Live particle frames in a POSIX shared memory ring, one producer (the solver, see FramePublisher) and any number of
+   readers that never block it. Shared between the C++ producer and the C client library, so plain C only.
+
+   Layout: FrameRingHeader, then slotCount slots of slotBytes each, every slot a FrameSlotHeader followed by
+   particleCount rows of fieldCount floats (position.xyz, density, velocity.xyz, mass).
+
+   Protocol: frame n goes to slot n % slotCount. The producer sets the slot version to 2n + 1 while it writes and to
+   2n + 2 once the frame is complete, then publishes n as the latest sequence. A reader copies a slot out and keeps
+   the copy only if the version read before and after the copy is the same even 2n + 2, otherwise the producer lapped
+   it and it retries with the latest frame. Readers that fall more than slotCount frames behind skip ahead.     */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RING_MAGIC 0x53504852u /* "RHPS" */
+#define FRAME_RING_VERSION 1u
+#define FRAME_RING_FIELDS 8u
+
+typedef struct FrameRingHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotCapacity;    /* particles per slot                          */
+    uint32_t fieldCount;      /* floats per particle                         */
+    uint32_t padding;
+    uint64_t slotBytes;       /* header and rows, slots start at sizeof(FrameRingHeader) */
+    uint64_t sequence;        /* latest complete frame, written atomically; ~0 before the first one */
+} FrameRingHeader;
+
+typedef struct FrameSlotHeader{
+    uint64_t version;         /* 2n + 1 while frame n is written, 2n + 2 once it is complete, written atomically */
+    uint64_t frame;
+    uint32_t particleCount;
+    float time;               /* simulated seconds */
+} FrameSlotHeader;
+
+#define FRAME_RING_NONE UINT64_MAX
+
+/* Client side, see src/FrameRingClient.c */
+
+typedef struct FrameRingReader{
+    FrameRingHeader* header;
+    size_t mappedBytes;
+    uint64_t next;            /* next frame this reader wants */
+    uint64_t skipped;         /* frames it never saw because it fell behind or lost a race */
+} FrameRingReader;
+
+typedef struct Frame{
+    uint64_t frame;
+    uint32_t particleCount;
+    float time;
+    float* data;              /* particleCount * fieldCount floats, owned by the caller */
+} Frame;
+
+/* name as given to --publish, returns 0 on success and -1 with errno set otherwise */
+int frame_ring_open(FrameRingReader* reader, const char* name);
+void frame_ring_close(FrameRingReader* reader);
+
+/* Copies the oldest frame the reader has not seen yet that is still in the ring into out, whose data has to hold
+   slotCapacity * fieldCount floats. Returns 1 for a frame, 0 if nothing new was published and never blocks. */
+int frame_ring_read(FrameRingReader* reader, Frame* out);
+
+/* Same, but jumps straight to the latest frame */
+int frame_ring_read_latest(FrameRingReader* reader, Frame* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
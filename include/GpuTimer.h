@@ -0,0 +1,49 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "Trace.h"
+
+//Times GPU work with a ring of GL_TIME_ELAPSED queries, results are collected a few frames late so nothing stalls.
+//With a trace name, spans begun while a trace is recorded also get a start timestamp and go to the trace.
+class GpuTimer{
+public:
+    void init(unsigned int latency = 4, const char* traceName = nullptr);
+    void cleanup();
+
+    //Measures the offset between the GL and CPU clocks for GPU spans in the trace, see Trace.h
+    static void calibrateTraceClock();
+
+    //Only one span can be open at a time, weight is what the span counts for in the average (e.g. steps)
+    void begin();
+    void end(unsigned int weight = 1);
+
+    //Average milliseconds per unit of weight over everything collected since the last reset
+    double getAverage();
+    unsigned int getSampleWeight();
+    void reset();
+private:
+    struct Span{
+        GLuint query;
+        GLuint startQuery;
+        unsigned int weight;
+        bool pending;
+        bool traced;
+    };
+
+    const char* traceName = nullptr;
+
+    std::vector<Span> spans;
+    size_t next = 0;
+    bool open = false;
+    double totalMs = 0.0;
+    unsigned int totalWeight = 0;
+
+    void collect();
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PARTICLE_EXPORTER_H
+#define PARTICLE_EXPORTER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Solver.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+enum ExportFormat {EXPORT_VTU, EXPORT_VTK, EXPORT_PLY, EXPORT_RAW};
+
+enum ExportAttribute {
+    EXPORT_POSITION = 1 << 0,
+    EXPORT_VELOCITY = 1 << 1,
+    EXPORT_DENSITY = 1 << 2,
+    EXPORT_PRESSURE = 1 << 3,
+    EXPORT_MASS = 1 << 4
+};
+
+//Writes particles as binary VTU (appended raw), legacy binary VTK, binary PLY or raw float32 columns. The body is
+//formatted batch by batch on all threads into one preformatted buffer, each batch then goes out in a single write.
+class ParticleExporter{
+public:
+    static constexpr size_t batchSize = 1 << 20; //particles formatted per parallel pass
+
+    void init(ThreadPool* threadPool, ExportFormat format, unsigned int attributes);
+
+    //Formats are vtu, vtk, ply and raw, attributes a comma separated list of position, velocity, density, pressure and mass
+    static ExportFormat parseFormat(const std::string& name);
+    static unsigned int parseAttributes(const std::string& list);
+
+    //Writes basename plus the format's extension, raw columns go to one basename.<attribute>.f32 each next to a
+    //basename.txt describing them. Returns the main file's name.
+    std::string exportParticles(const std::vector<particle>& particles, const std::string& basename);
+private:
+    struct Attribute{
+        ExportAttribute flag;
+        const char* name;
+        int components;
+        const char* plyProperties;
+    };
+    static const Attribute attributeTable[5];
+
+    ThreadPool* threadPool;
+    ExportFormat format;
+    unsigned int attributes;
+    std::vector<char> buffers[2]; //one batch is written while the next is formatted
+    size_t bytesWritten;
+
+    std::vector<Attribute> getAttributes();
+    static void readAttribute(const particle& p, ExportAttribute attribute, float* out);
+
+    //Formats count records of stride bytes with fill(begin, end, out) in parallel batches and writes each batch at once
+    void writeSection(std::ofstream& file, size_t count, size_t stride, const std::function<void(size_t, size_t, char*)>& fill);
+    void writeText(std::ofstream& file, const std::string& text);
+    void writeColumn(std::ofstream& file, const std::vector<particle>& particles, const Attribute& attribute, bool bigEndian);
+
+    void exportVTU(const std::vector<particle>& particles, const std::string& filename);
+    void exportVTK(const std::vector<particle>& particles, const std::string& filename);
+    void exportPLY(const std::vector<particle>& particles, const std::string& filename);
+    void exportRaw(const std::vector<particle>& particles, const std::string& basename);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef REGRESSION_HARNESS_H
+#define REGRESSION_HARNESS_H
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Solver.h"
+
+//Runs a scene for a fixed number of steps and compares speed and physics against a recorded reference run
+class RegressionHarness{
+public:
+    static constexpr int sampleInterval = 60; //steps between physics samples
+
+    //scene names the options the run was configured with, a reference only compares against the same scene
+    void init(SPH* solver, const std::string& scene, int steps);
+    void run();
+
+    void record(const std::string& filename);
+
+    //Writes a comparison report and returns false if anything regressed beyond its tolerance. Performance may drop by
+    //performanceTolerance as a fraction, physics metrics may drift by physicsTolerance relative to their scale.
+    bool compare(const std::string& filename, const std::string& reportFile, double performanceTolerance, double physicsTolerance);
+private:
+    enum MetricKind {HIGHER_IS_BETTER, LOWER_IS_BETTER, PHYSICS};
+
+    struct Metric{
+        std::string name;
+        double value;
+        MetricKind kind;
+        double scale; //physics drift is measured against max(|reference|, scale)
+    };
+
+    SPH* solver;
+    std::string scene;
+    int steps;
+    std::vector<Metric> metrics;
+    std::vector<particle> particles;
+
+    void sample(int step);
+    void samplePhysics(const std::string& prefix, const SimParams& params);
+    void addMetric(const std::string& name, double value, MetricKind kind, double scale = 0.0);
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <cstddef>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -12,30 +13,72 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "ShaderLoader.h"
 #include "Solver.h"
+#include "SurfaceExtractor.h"
+#include "Trace.h"
 
 enum RenderMode {
     RENDER_POINTS,
     RENDER_SSFR,
+    RENDER_MESH,
+    RENDER_MESH_GPU,
     RENDER_MODE_COUNT
 };
 
 static int _width = 800;
 static int _height = 600;
 
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
 class Renderer{
 public:
     void init(GLFWwindow* window, SPH* solver);
     void mainLoop();
     void cleanup();
+
+    void setSurfaceMesh(const SurfaceMesh* mesh);
+    void setSurfaceScene(int scene);
+    void cycleRenderMode();
+    int getRenderMode();
 private:
     SPH* _solver;
     GLFWwindow* _window;
+    const SurfaceMesh* _surfaceMesh = nullptr;
+    int surfaceScene = 0; //ensemble scene the GPU surface mesh covers
+
+    //Only runs while a trace is recorded, see Trace.h
+    GpuTimer renderTimer;
 
     GLuint VAO = 0;
+    GLuint culledVAO = 0;
+    GLuint meshVAO, meshVBO = 0;
+    GLuint gpuMeshVAO = 0;
     GLuint quadVAO, quadVBO, quadEBO = 0;
-    GLuint pointsProgram, ssfrProgram = 0;
-    GLuint viewMatrixLocation = 0;
+    GLuint culledSSBO, indirectBuffer = 0;
+    GLuint pointsProgram, ssfrProgram, cullProgram, meshProgram = 0;
+    GLuint viewMatrixLocation, meshViewMatrixLocation = 0;
+    GLuint positionScaleLocation, positionBiasLocation = 0;
+    GLuint mvpMatrixLocation, frustumPlanesLocation = 0;
+    GLuint particleRadiusLocation, projectionScaleLocation, viewportHeightLocation = 0;
+    GLuint minPixelSizeLocation, decimationStrideLocation, ownedCountLocation = 0;
+
+    //GPU marching cubes
+    static constexpr int mcResolution = 64;            //density nodes along each axis
+    static constexpr GLuint mcVertexCapacity = 1 << 20;
+    static constexpr float mcDensityScale = 65536.0f;  //fixed point scale for the integer density atomics
+    float mcIsoLevel = 0.5f;
+
+    GLuint mcSplatProgram, mcClassifyProgram, mcCompactProgram, mcGenerateProgram, scanProgram = 0;
+    GLuint mcDensityTexture = 0;
+    GLuint mcTableBuffer, mcCubeIndexBuffer, mcActiveCellBuffer, mcVertexBuffer = 0;
+    GLuint mcDispatchBuffer, mcDrawBuffer = 0;
+    GLuint scanInputBuffer, scanOutputBuffer, scanBlockSumBuffer = 0;
     GLuint framebuffer = 0;
     GLuint colorTexture, depthTexture = 0;
 
@@ -44,16 +87,32 @@ private:
     std::vector<float> properties;
 
     glm::mat4 viewMatrix;
+    glm::mat4 modelMatrix;      //mirrors the constant model matrix in points.vert
+    glm::mat4 projectionMatrix; //mirrors the constant projection matrix in points.vert
 
     int renderMode = RENDER_SSFR;
 
+    uint64_t uploadedMeshVersion = 0;
+    GLsizei meshVertexCount = 0;
+
+    bool cullParticles = true;
+    float particleRadius = 0.05f;
+    float minPixelSize = 2.0f;
+    GLuint decimationStride = 4;
+
     void configureBuffers();
     void compileAndLoadShaders();
+    void cullAndCompactParticles();
+    void drawParticles();
+    void uploadSurfaceMesh();
+    void configureMarchingCubes();
+    void extractSurfaceOnGPU();
+    void prefixSum(GLuint elementCount);
 
     static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-    static std::vector<char> readFile(const std::string& filename);
 
     GLuint buildShaderFromSource(const std::string& filenameFrag, const std::string& filenameVert);
+    GLuint buildShaderFromSource(const std::string& filenameComp);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef SHADERLOADER_H
+#define SHADERLOADER_H
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+class ShaderLoader{
+public:
+    //Reads a shader, resolves #include "file" relative to it and adds a #define after #version for each entry of defines
+    static std::string loadSource(const std::string& filename, const std::vector<std::string>& defines = {});
+private:
+    static std::string resolveIncludes(const std::string& filename, int depth);
+    static std::string readFile(const std::string& filename);
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SIMPARAMS_H
+#define SIMPARAMS_H
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+//Solver parameters, defaults are the original scene. Everything except particleCount can change between steps, see SPH::setParams.
+struct SimParams{
+    int particleCount = 1000;
+    int substeps = 10;
+    float timestep = 1.0f / 600.0f; //per substep
+    float h = 0.2f;                 //smoothing length and grid cell size
+    float stiffness = 100.0f;
+    float restDensity = 500.0f;
+    float viscosity = 0.1f;
+    float mass = 1.0f;              //base particle mass
+    float damping = 0.1f;           //share of the normal velocity lost on wall contact
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+
+    //Sleeping and adaptive resolution thresholds, see sph_params.glsl
+    float sleepVelocity = 0.05f;
+    float sleepDensityChange = 0.002f;
+    int sleepSteps = 30;
+    float splitDensity = 0.85f;
+    float mergeDensity = 0.95f;
+
+    //One "name value" pair per line, # starts a comment, gravity takes three values, anything left out keeps its default
+    static SimParams load(const std::string& filename);
+    void validate() const;
+};
+
+#endif
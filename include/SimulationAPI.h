@@ -0,0 +1,43 @@
+#ifndef SIMULATION_API_H
+#define SIMULATION_API_H
+
+/* Plain C entry points into a headless solver, built as libfluidsim for the Python bindings in python/fluidsim.py.
+   Particle streams are persistently mapped, the stream pointers stay valid until fluidsim_destroy and always hold the
+   state after the last fluidsim_step. Calls that fail return NULL or -1 and leave a message for fluidsim_last_error. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Simulation Simulation;
+
+enum SimulationFlags{
+    SIMULATION_DETERMINISTIC = 1,
+    SIMULATION_SLEEP = 2,
+    SIMULATION_BOUNDARY_PARTICLES = 4
+};
+
+//paramsFile may be NULL for the default scene, shaderDirectory holds the compute shaders
+Simulation* fluidsim_create(const char* paramsFile, const char* shaderDirectory, int flags);
+void fluidsim_destroy(Simulation* simulation);
+
+//Runs whole fixed steps and waits for the GPU, so the mapped streams are safe to read afterwards
+int fluidsim_step(Simulation* simulation, int steps);
+
+int fluidsim_particle_count(Simulation* simulation);
+int fluidsim_particle_capacity(Simulation* simulation);
+
+//Streams as in particle.glsl, capacity rows of vec4: hot (position, density), warm (velocity, mass), cold (NaN flag, zero density neighbor, scene, user)
+float* fluidsim_stream(Simulation* simulation, int stream);
+
+//Pressure is never stored, it follows from the density with these two
+float fluidsim_stiffness(Simulation* simulation);
+float fluidsim_rest_density(Simulation* simulation);
+
+const char* fluidsim_last_error();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,9 +1,13 @@
 #ifndef SOLVER_H
 #define SOLVER_H
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <limits>
+#include <cstddef>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <random>
 #include <stdexcept>
@@ -14,40 +18,349 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include "BoundarySDF.h"
+#include "GpuTimer.h"
+#include "ShaderLoader.h"
+#include "SimParams.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "TriangleMesh.h"
+
+//velocity.w carries the particle mass, properties hold (density, pressure, NaN flag, zero density neighbor)
 struct particle{
     glm::vec4 position;
     glm::vec4 velocity;
     glm::vec4 properties;
 };
 
+//Spawns rate particles per second over a disc of the given radius facing its velocity
+struct Emitter{
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float radius;
+    float rate;
+    float accumulated = 0.0f;
+};
+
+enum SinkType {SINK_PLANE, SINK_BOX};
+
+//Planes remove particles with dot(a.xyz, x) + a.w < 0, boxes remove particles inside [a, b)
+struct Sink{
+    SinkType type;
+    glm::vec4 a;
+    glm::vec4 b;
+};
+
+//Mirrors simStateBuffer in particle.glsl, the live count never leaves the GPU during a step
+struct SimState{
+    GLuint particleDispatch[3];
+    GLuint liveCount;
+    GLuint particleDraw[4];
+    GLuint scanDispatch[3];
+    GLuint padding;
+    GLuint activeDispatch[3];
+    GLuint activeCount;
+    GLuint spawnCount;
+};
+
+//Mirrors the std140 SimParams block in sph_params.glsl, filled from SimParams
+struct SimParamsBlock{
+    glm::vec3 g;
+    float timestep;
+    float h;
+    float k;
+    float p0;
+    float mu;
+    float mass;
+    float minMass;
+    float damping;
+    float sleepVelocity;
+    float sleepDensityChange;
+    GLuint sleepSteps;
+    float splitDensity;
+    float mergeDensity;
+    GLuint gridLength;
+    GLuint padding[3];
+};
+
+//Mirrors Scene in sph_common.glsl, one row per ensemble scene
+struct SceneParamsBlock{
+    float k;
+    float p0;
+    float mu;
+    float damping;
+    glm::vec4 g;
+};
+
+//Mirrors gridStatsBuffer in sph_stats.comp, the pair totals are split into low and high words
+struct GridStats{
+    static constexpr int bins = 64;
+    static constexpr int neighborBinWidth = 2;
+
+    GLuint neighborHistogram[bins];
+    GLuint occupancyHistogram[bins];
+    GLuint maxCellLength;
+    GLuint maxNeighbors;
+    GLuint sampledParticles;
+    GLuint occupiedCells;
+    GLuint visitedPairs[2];
+    GLuint neighborPairs[2];
+};
+
+//Stages timed separately for the regression harness, in the order a step runs them
+enum SolverStage {STAGE_INSERT, STAGE_SORT, STAGE_DENSITY, STAGE_FORCE, STAGE_INTEGRATE, STAGE_SLEEP, STAGE_EMIT, STAGE_STATS, STAGE_COUNT};
+
 class SPH{
 public:
-    static constexpr float h = 0.2;
-    static constexpr int particleCount = 1000;
     static constexpr std::chrono::duration<double> fixedTimeStep = std::chrono::duration<double>(1.0f / 60.0f);
 
-    void init();
+    //Simulation domain, this matches particle.glsl, everything else is in SimParams
+    static constexpr float domainMin = -1.0f;
+    static constexpr float domainMax = 1.0f;
+
+    //Upper bound of the compaction scan, see scan.comp
+    static constexpr int maxParticleCapacity = 1024 * 1024;
+    static constexpr int maxSinks = 8;
+
+    //Frames between sleeping, adaptive resolution and deterministic mode reports
+    static constexpr int reportInterval = 300;
+    static constexpr unsigned int deterministicSeed = 1;
+
+    //Takes effect with the next step, changing h resizes the grid but nothing recompiles
+    void setParams(const SimParams& newParams);
+    const SimParams& getParams();
+
+    //Starts over from fresh particles for the current parameters, keeping buffers and programs
+    void reset();
+
+    void setCompactStorage(bool compact);
+    bool isCompactStorage();
+
+    //Quiet cells stop being simulated until a neighbor moves again, see sph_sleep.comp
+    void setSleeping(bool sleeping);
+
+    //Split particles near the free surface and walls, merge them again in the bulk, see sph_adapt.comp
+    void setAdaptiveResolution(bool adaptive);
+    bool isAdaptiveResolution();
+    std::vector<std::string> getShaderDefines();
+
+    //Emitters and sinks have to be added before init, capacity bounds the live count
+    void setParticleCapacity(int capacity);
+    void addEmitter(const Emitter& emitter);
+    void addSink(const Sink& sink);
+
+    //Container or obstacle geometry as an OBJ whose triangles face the fluid, the domain box when unset
+    void setBoundaryMesh(const std::string& filename);
+
+    //Represent the boundary by Akinci style particles in the density and pressure sums, see sph_common.glsl
+    void setBoundaryParticles(bool enabled);
+
+    //Sort every cell's neighbor list by particle index and seed the initial state, so runs are bitwise repeatable
+    void setDeterministic(bool deterministic);
+
+    //Trailing particles are ghosts owned by another rank, they feed the density and force sums but are never moved
+    void setDomainGhosts(bool enabled);
+
+    //Steps every scene in one pipeline, each with its own particles, grid layer and parameters. Scenes may differ
+    //in particle count, stiffness, rest density, viscosity, damping and gravity and have to share everything else.
+    void setEnsemble(const std::vector<SimParams>& scenes);
+    int getSceneCount();
+    const SimParams& getSceneParams(int scene);
+
+    //Allocate the hot, warm and cold streams as persistently mapped, coherent buffers, so the CPU reads and writes
+    //particles in place instead of through readParticles. Call syncMappedStreams before touching them after a step.
+    void setMappedStreams(bool mapped);
+    void* getMappedStream(int stream);
+    void syncMappedStreams();
+
+    //Where the compute shaders are loaded from, relative to the working directory unless absolute
+    void setShaderDirectory(const std::string& directory);
+
+    //Runs on the CPU before every fixed step, the only point where particles may be read back and replaced
+    void setStepHook(const std::function<void()>& hook);
+
+    //Gather neighbor counts and cell occupancy on the GPU every interval steps, see sph_stats.comp. The results are
+    //read back through fences a few frames later and reported, 0 turns them off. Has to be set before init.
+    void setGridStatistics(int interval);
+    const GridStats& getGridStats();
+    int getGridStatsStep(); //-1 until the first statistics arrived
+
+    void init(ThreadPool* threadPool);
     void mainLoop();
     void cleanup();
 
+    //Runs exactly steps fixed steps right away, independent of the wall clock
+    void advance(int steps);
+
+    //Simulated seconds since init or the last reset
+    double getSimulatedTime();
+
+    //GPU milliseconds spent in every SolverStage since the last reset, reading them waits for the GPU
+    static constexpr const char* stageNames[STAGE_COUNT] = {"insert", "sort", "density", "force", "integrate", "sleep", "emit", "stats"};
+    void setStageTiming(bool enabled);
+    std::vector<double> getStageTimes();
+    void resetStageTimes();
+
+    //The hot stream (position and density) and its per particle stride, which is all the renderer reads
     GLuint getBufferId();
-    int getParticleCount();
     size_t getParticleSize();
+    int getParticleCapacity();
+
+    //Holds the live count and the indirect dispatch and draw arguments derived from it, see SimState
+    GLuint getStateBufferId();
+    static constexpr GLintptr particleDispatchOffset = offsetof(SimState, particleDispatch);
+    static constexpr GLintptr particleDrawOffset = offsetof(SimState, particleDraw);
+    static constexpr GLintptr activeDispatchOffset = offsetof(SimState, activeDispatch);
+
+    //Reads the live count back, this stalls until the GPU caught up and is meant for CPU side consumers only
+    int getParticleCount();
+    void readParticles(std::vector<particle>& out);
+
+    //One ensemble scene's particles, slots never move in ensemble mode so this reads a single range
+    void readScene(int scene, std::vector<particle>& out);
+
+    //Replaces every particle, the first ownedCount are simulated and drawn, the rest are ghosts
+    void writeParticles(const std::vector<particle>& in, int ownedCount);
+    int getOwnedCount();
+    const std::vector<particle>& getInitialParticles();
 private:
+    SimParams params;
+    GLuint paramsUBO;
+    bool initialized = false;
+    ThreadPool* threadPool;
+
     std::vector<particle> particles;
-    int _particleCount;
-    GLuint hLocation;
-    GLuint particleSSBO, gridSSBO, listSSBO;
-    GLuint updateProgram;
+    int _particleCapacity = 0;
+    size_t gridSize;
+    GLuint hotSSBO, warmSSBO, coldSSBO, accelerationSSBO, gridSSBO, listSSBO;
+    GLuint insertProgram, densityProgram, forceProgram, integrateProgram;
+
+    //Emission and stream compaction
+    std::vector<Emitter> emitters;
+    std::vector<Sink> sinks;
+    GLuint stateSSBO, aliveFlagSSBO, aliveOffsetSSBO, blockSumSSBO;
+    GLuint hotScratchSSBO, warmScratchSSBO, coldScratchSSBO;
+    GLuint sinkProgram, scanProgram, compactProgram, emitProgram, updateStateProgram;
+    unsigned int emitSeed = 0;
+
+    //Sleeping
+    bool sleeping = false;
+    GLuint cellSleepSSBO, activeListSSBO;
+    GLuint sleepProgram;
+    GpuTimer stepTimer;
+    double awakeStepTime = 0.0;
+    int stepsTaken = 0;
+    int framesSinceReport = 0;
+
+    //Adaptive resolution
+    bool adaptiveResolution = false;
+    GLuint mergePartnerSSBO;
+    GLuint adaptProgram;
+
+    //Boundary signed distance field, baked on the CPU and sampled from a 3D texture
+    std::string boundaryMesh;
+    BoundarySDF boundary;
+    GLuint boundaryTexture;
+
+    //Boundary particles, sorted by grid cell with one (first, count) range per cell
+    bool boundaryParticles = false;
+    GLuint boundaryCellSSBO, boundaryParticleSSBO;
+
+    //Deterministic neighbor order, its cost is the sort relative to the passes it feeds
+    bool deterministic = false;
+    GLuint sortCellsProgram;
+    GpuTimer sortTimer, passTimer;
+
+    //Timestamps between stages, resolved only when someone asks for the stage times
+    bool stageTiming = false;
+    std::vector<GLuint> stageQueries;
+    std::vector<int> stageMarks;
+    size_t stageMarkCount = 0;
+    std::vector<double> stageTimes;
+
+    //Ensemble scenes, scene i owns the slots [sceneOffsets[i], sceneOffsets[i + 1]) and layer i of the grid
+    std::vector<SimParams> ensemble;
+    std::vector<int> sceneOffsets;
+    GLuint sceneSSBO;
+
+    //Persistently mapped streams, indexed like the bindings
+    bool mappedStreams = false;
+    void* streamPointers[3] = {nullptr, nullptr, nullptr};
+    std::string shaderDirectory = "../shaders/";
+
+    //Grid statistics, copied into a ring of readback buffers that are collected once their fence signaled
+    static constexpr int statsReadbacks = 3;
+    struct StatsReadback{
+        GLuint buffer;
+        GLsync fence = nullptr;
+        int step;
+    };
+    int statsInterval = 0;
+    int statsStep = 0;
+    GLuint statsSSBO;
+    GLuint statsProgram;
+    StatsReadback statsReadback[statsReadbacks];
+    int nextStatsReadback = 0;
+    GridStats gridStats = {};
+    int gridStatsStep = -1;
+
+    //Domain decomposition
+    bool domainGhosts = false;
+    int ownedCount = 0;
+    std::function<void()> stepHook;
+
+    double simulatedTime = 0.0;
     std::chrono::duration<double, std::nano> accumulator;
     std::chrono::time_point<std::chrono::high_resolution_clock> currentTime;
     bool firstLoop;
+    bool compactStorage = false;
 
+    GLuint createStream(int stream, size_t size);
     void compileAndLoadShaders();
-    GLuint buildShaderFromSource(const std::string& filenameComp);
+    GLuint buildShaderFromSource(const std::string& filenameComp, const std::vector<std::string>& extraDefines = {});
     void initializeFirstLoop();
-    std::vector<char> readFile(const std::string& filename);
+    void bindBuffers();
+    void fixedStep();
+    void markStage(int stage);
+    void resolveStageTimes();
+    void dispatchPass(GLuint program);
+    void setPassUniforms(GLuint program);
+    void spawnParticles();
+    void uploadParams();
+    void uploadScenes();
+    void resizeGrid();
+    GLuint getGridLength();
+    TriangleMesh loadBoundaryMesh();
+    void buildBoundary();
+    void buildBoundaryParticles(const TriangleMesh& mesh);
+    int getCellIndex(const glm::vec3& position);
+    static float poly6(float r, float h);
+    void removeAndEmitParticles(float dt);
+    void compactParticles();
+    void emitParticles(float dt);
+    void updateState(GLuint mode, GLuint appendCount);
+    void updateSleeping();
+    void reportSleeping();
+    void mergeParticles();
+    void splitParticles();
+    void reportAdaptiveResolution();
+    void sortCells();
+    void reportDeterministic();
+    void gatherGridStats();
+    void collectGridStats();
+    void reportGridStats();
+    void reportStorageError();
+    void readParticleRange(std::vector<particle>& out, int first, int count, const SimParams& scene);
+    void tagScenes(std::vector<glm::vec4>& cold);
+
+    size_t getWarmSize();
+    static float pressureFromDensity(float density, const SimParams& scene);
+    static glm::uvec2 packHot(const particle& p);
+    static glm::uvec2 packWarm(const particle& p);
+    static void unpackHot(const glm::uvec2& packed, particle& p);
+    static void unpackWarm(const glm::uvec2& packed, particle& p);
 };
 
 #endif
\ No newline at end of file
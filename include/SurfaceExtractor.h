@@ -0,0 +1,76 @@
+#ifndef SURFACEEXTRACTOR_H
+#define SURFACEEXTRACTOR_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Solver.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+struct MeshVertex{
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+//Non-indexed triangle list, version changes whenever the vertices do
+struct SurfaceMesh{
+    std::vector<MeshVertex> vertices;
+    uint64_t version = 0;
+};
+
+class SurfaceExtractor{
+public:
+    static constexpr int blockCells = 8; //cells along each edge of a block
+
+    //baseMass is the mass that splats with full weight, split particles contribute their share of it
+    void init(ThreadPool* threadPool, float cellSize, float kernelRadius, float isoLevel, float baseMass);
+    void extract(const std::vector<particle>& particles);
+    void exportPLY(const std::string& filename);
+    void cleanup();
+
+    const SurfaceMesh& getMesh();
+    size_t getBlockCount();
+    size_t getReusedBlockCount();
+private:
+    //Density samples of a block including a one node apron on each side for central differences
+    static constexpr int sampleCount = blockCells + 3;
+
+    struct Block{
+        std::vector<glm::vec4> points; //position and mass weight of the particles inside, first touched by the owning thread
+        std::vector<float> density;
+        std::vector<MeshVertex> triangles;
+        uint64_t densityHash = 0;
+        bool meshed = false;
+    };
+
+    ThreadPool* _threadPool;
+    float _cellSize;
+    float _kernelRadius;
+    float _isoLevel;
+    float _baseMass;
+
+    std::unordered_map<uint64_t, Block> blocks;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> blockParticles;
+    SurfaceMesh mesh;
+    size_t reusedBlocks = 0;
+
+    static uint64_t packBlockKey(const glm::ivec3& blockIndex);
+    static glm::ivec3 unpackBlockKey(uint64_t key);
+
+    glm::ivec3 getBlockIndex(const glm::vec3& position);
+    void forEachBlock(const std::vector<uint32_t>& costs, const std::function<void(size_t, size_t)>& task);
+    void splatBlock(uint64_t key, Block& block);
+    uint64_t hashBlock(const Block& block);
+    void polygonizeBlock(uint64_t key, Block& block);
+};
+
+#endif
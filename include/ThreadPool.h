@@ -0,0 +1,82 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+class ThreadPool{
+public:
+    //Pin every thread to a core, ordered node by node, so thread ranges map onto NUMA nodes. Has to be set before init.
+    void setPinned(bool pinned);
+
+    void init(unsigned int threadCount = 0);
+    void cleanup();
+
+    //Chunks handed out per thread, enough for stealing to even out chunks of different cost
+    static constexpr unsigned int chunksPerThread = 8;
+
+    //Runs task(begin, end) over [0, count) split into chunks, the calling thread helps until all chunks are done
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& task);
+
+    //Like parallelFor, but chunks hold about the same total cost instead of the same number of items
+    void parallelForWeighted(const std::vector<uint32_t>& costs, const std::function<void(size_t, size_t)>& task);
+
+    //Splits [0, count) into one contiguous range per thread, thread t always runs range t. Memory first touched in
+    //a range stays on that thread's node, so later calls over the same ranges read locally.
+    void parallelForPinned(size_t count, const std::function<void(size_t, size_t)>& task);
+
+    unsigned int getThreadCount();
+    bool isPinned();
+    unsigned int getNodeCount();
+    unsigned int getThreadNode(unsigned int thread);
+
+    //Streams a buffer first touched by each thread and prints the read bandwidth reached per node
+    void reportNodeBandwidth();
+
+    //Prints how busy each thread was inside parallel loops since the last report, and how often it stole
+    void reportUtilization();
+private:
+    //Chunks start out spread over per thread deques in order, owners pop their newest chunk and thieves take the oldest
+    struct Worker{
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::queue<std::function<void()>> pinnedTasks; //never stolen, see parallelForPinned
+        std::atomic<uint64_t> busyNanoseconds{0};
+        std::atomic<uint64_t> steals{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Worker>> threads; //index 0 is the calling thread
+    std::atomic<size_t> queuedTasks{0};
+    std::atomic<uint64_t> parallelNanoseconds{0};
+    std::mutex queueMutex; //guards sleeping and the pinned queues
+    std::condition_variable queueCondition;
+    bool stopping = false;
+
+    //CPUs of each node in ascending order, one node holding every CPU when the topology is unknown
+    bool pinned = false;
+    std::vector<std::vector<int>> nodeCpus;
+    std::vector<unsigned int> threadNodes;
+
+    void schedule(const std::vector<size_t>& chunkBounds, const std::function<void(size_t, size_t)>& task);
+    void workerLoop(unsigned int index);
+    bool runPendingTask(unsigned int index);
+    void runTimed(unsigned int index, const std::function<void()>& task);
+    void readTopology();
+    void pinThread(unsigned int thread, bool wholeNode);
+    static std::vector<int> parseCpuList(const std::string& list);
+};
+
+#endif
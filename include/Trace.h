@@ -0,0 +1,116 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* CPU trace zones, GPU spans and counters on one timeline, written as Chrome trace JSON (chrome://tracing, Perfetto).
+   TRACE_ZONE times the rest of its scope on the calling thread. Every thread appends to its own buffer of event
+   blocks with no locking, only its first event takes a lock to register the buffer. GPU spans come from GL_TIMESTAMP
+   queries and are shifted onto the CPU clock by an offset measured with glGetInteger64v(GL_TIMESTAMP).
+
+   The macros compile to nothing unless FLUIDSIM_TRACE is defined (the FLUIDSIM_TRACE CMake option, off for
+   Release builds); compiled in, a zone costs one relaxed load while no trace is being recorded. Zone and span
+   names have to be string literals, only their pointers are stored. */
+
+#ifdef FLUIDSIM_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Trace::setThreadName(name)
+#else
+#define TRACE_ZONE(name)
+#define TRACE_THREAD_NAME(name)
+#endif
+
+class Trace{
+public:
+    static constexpr size_t blockEvents = 16384;
+    static constexpr size_t maxBlocks = 1024; //per thread, later events are dropped and counted
+
+    //Starts recording, throws when the build has the zones compiled out
+    static void start();
+    static void stop();
+
+#ifdef FLUIDSIM_TRACE
+    static bool isEnabled(){
+        return enabled.load(std::memory_order_relaxed);
+    }
+#else
+    static constexpr bool isEnabled(){
+        return false;
+    }
+#endif
+
+    //Steady clock nanoseconds, the timeline every event is placed on
+    static int64_t now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void record(const char* name, int64_t start, int64_t end);
+
+    //GPU timestamps in nanoseconds, gpuClockOffset is the CPU time minus the GPU time at the same moment
+    static void recordGpu(const char* name, int64_t gpuStart, int64_t gpuEnd);
+    static void setGpuClockOffset(int64_t offset);
+
+    //A sample of a value plotted over time, such as a statistic read back from the GPU
+    static void recordCounter(const char* name, double value);
+
+    static void setThreadName(const std::string& name);
+
+    //Writes everything recorded so far, the threads recording have to be idle
+    static void write(const std::string& filename);
+private:
+    enum EventKind {EVENT_ZONE, EVENT_GPU, EVENT_COUNTER};
+
+    struct Event{
+        const char* name;
+        int64_t start;
+        int64_t end;
+        double value;
+        EventKind kind;
+    };
+
+    //Only its own thread appends, count is published after the event is written
+    struct ThreadBuffer{
+        std::string name;
+        uint32_t id;
+        std::atomic<size_t> count{0};
+        size_t dropped = 0;
+        std::unique_ptr<Event[]> blocks[maxBlocks];
+    };
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<int64_t> gpuClockOffset{0};
+    static inline std::mutex registryMutex;
+    static inline std::vector<std::unique_ptr<ThreadBuffer>> buffers; //outlive their threads
+
+    static ThreadBuffer* getThreadBuffer();
+    static void append(const Event& event);
+};
+
+class TraceZone{
+public:
+    explicit TraceZone(const char* name) : name(name), start(Trace::isEnabled() ? Trace::now() : 0) {}
+
+    ~TraceZone(){
+        if(start != 0) Trace::record(name, start, Trace::now());
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+private:
+    const char* name;
+    int64_t start;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "EntropyCoder.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+/* Compressed particle trajectories. Positions are quantized to a grid whose step keeps the error below errorBound
+   times the domain extent and are coded in a spatially coherent order, fixed by Morton code at every keyframe.
+   Keyframes store that order and every position as a delta to the one before it, the frames after a keyframe store
+   each position as a delta to the same particle in the previous frame. Every stream is cut into chunks that are
+   entropy coded on their own (see EntropyCoder) and coded in parallel.
+
+   File: TrajectoryHeader, frames, the index (uint64 offset and uint8 keyframe flag per frame), TrajectoryIndex.
+   Frame: TrajectoryFrameHeader, uint32 size per chunk, the chunks. Keyframes hold the order stream's chunks first,
+   then x, y and z. Without an index, because the writer never finished, frames are found by walking the file.
+   Readers map the whole file and decode straight from the mapping, seeking only looks up the index. */
+
+struct TrajectoryHeader{
+    uint32_t magic;
+    uint32_t version;
+    float errorBound;         //maximum position error relative to the domain extent
+    float domainMin;
+    float domainMax;
+    float step;               //quantization step, 2 * errorBound * extent
+    uint32_t keyframeInterval;
+    uint32_t chunkSize;       //values per chunk
+};
+
+struct TrajectoryFrameHeader{
+    uint32_t keyframe;
+    uint32_t particleCount;
+    float time;
+    uint32_t chunkCount;
+};
+
+struct TrajectoryIndex{
+    uint64_t indexOffset;
+    uint32_t frameCount;
+    uint32_t magic;
+};
+
+class TrajectoryWriter{
+public:
+    static constexpr uint32_t magic = 0x54485053;      //"SPHT"
+    static constexpr uint32_t indexMagic = 0x49485053; //"SPHI"
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t chunkSize = 16384;
+    static constexpr int reportInterval = 300; //frames between compression reports
+
+    void init(ThreadPool* threadPool, const std::string& filename, float domainMin, float domainMax, float errorBound, int keyframeInterval);
+    void cleanup();
+
+    //Particles are identified by their slot, a change in count starts a new keyframe
+    void writeFrame(const std::vector<glm::vec3>& positions, float time);
+private:
+    ThreadPool* threadPool;
+    std::ofstream file;
+    std::string filename;
+    TrajectoryHeader header;
+
+    //Coded position to particle slot, fixed between keyframes, and the last frame's quantized positions in that order
+    std::vector<uint32_t> order;
+    std::vector<glm::ivec3> previous;
+
+    std::vector<uint64_t> frameOffsets;
+    std::vector<uint8_t> keyframes;
+    uint64_t offset = 0;
+    uint64_t rawBytes = 0;
+    double encodeSeconds = 0.0;
+
+    void report();
+};
+
+class TrajectoryReader{
+public:
+    void init(ThreadPool* threadPool, const std::string& filename);
+    void cleanup();
+
+    const TrajectoryHeader& getHeader();
+    int getFrameCount();
+    bool isKeyframe(int frame);
+    uint64_t getFrameBytes(int frame);
+    uint32_t getParticleCount(int frame);
+    int getDecodedFrame();
+
+    //Asks the kernel to page in frames [first, last) ahead of decoding them
+    void prefetch(int first, int last);
+
+    //Positions in slot order. Decodes forward from the closest keyframe, or just the one frame when the previous
+    //call stopped right before it, so playing frames in order costs one frame each.
+    float readFrame(int frame, std::vector<glm::vec3>& positions);
+private:
+    ThreadPool* threadPool;
+    const uint8_t* data = nullptr;
+    size_t mappedSize = 0;
+    TrajectoryHeader header;
+    std::vector<uint64_t> frameOffsets;
+    std::vector<uint8_t> keyframes;
+    uint64_t fileSize; //end of the last frame
+
+    int decodedFrame = -1;
+    float decodedTime = 0.0f;
+    std::vector<uint32_t> order;
+    std::vector<glm::ivec3> current;
+
+    void decodeFrame(int frame);
+    void scanFrames();
+};
+
+#endif
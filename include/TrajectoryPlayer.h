@@ -0,0 +1,68 @@
+#ifndef TRAJECTORY_PLAYER_H
+#define TRAJECTORY_PLAYER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Trajectory.h"
+
+struct ReplayFrame{
+    float time;
+    std::vector<glm::vec3> positions;
+};
+
+/* Plays back a trajectory written with --trajectory. A background thread with its own thread pool decodes the
+   frames around the playhead into a cache, ahead in the direction it last moved, so the render loop only ever
+   picks up finished frames and never waits on decoding. Frames between a keyframe and a frame asked for are all
+   kept, and frames behind the playhead are evicted first, so stepping backwards costs about as much as stepping
+   forwards once a keyframe interval is decoded. A frame that fails to decode stops the decoder, the error is
+   rethrown by the next seek or getFrame. */
+class TrajectoryPlayer{
+public:
+    static constexpr int maxPrefetchFrames = 30; //frames decoded ahead of the playhead when the cache has room
+    static constexpr size_t cacheBytes = size_t(1) << 30; //decoded positions kept around the playhead
+    static constexpr int maxCacheFrames = 300;
+
+    void init(const std::string& filename, unsigned int threadCount = 0);
+    void cleanup();
+
+    int getFrameCount();
+    int getKeyframeInterval();
+    uint32_t getMaxParticleCount();
+
+    //Moves the playhead, the decoder starts on it right away
+    void seek(int frame);
+
+    //The frame if it has been decoded yet, otherwise null
+    std::shared_ptr<const ReplayFrame> getFrame(int frame);
+private:
+    ThreadPool threadPool;
+    TrajectoryReader reader;
+    std::thread decoder;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    int playhead = 0;
+    int direction = 1;
+    std::map<int, std::shared_ptr<const ReplayFrame>> cache;
+    std::exception_ptr decodeError;
+
+    int frameCount = 0;
+    int cacheFrames = 0;
+    int prefetchFrames = 0;
+    uint32_t maxParticleCount = 0;
+
+    void decoderLoop();
+    void decodeRun(int target);
+    int nextMissingFrame();
+    void evictFrames();
+};
+
+#endif
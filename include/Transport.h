@@ -0,0 +1,49 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//Moves byte messages between the processes of one simulation, ranks are numbered 0 to size - 1
+class Transport{
+public:
+    virtual ~Transport() = default;
+
+    virtual int getRank() = 0;
+    virtual int getSize() = 0;
+
+    //Sends outgoing[i] to peers[i] and receives one message from each of them into incoming[i].
+    //Everything progresses at once, so two ranks sending each other large messages cannot deadlock.
+    //Returns false once a peer has gone away, nothing more can be exchanged after that.
+    virtual bool exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) = 0;
+};
+
+//Processes on one machine connected pairwise by Unix domain socket pairs
+class UnixSocketTransport : public Transport{
+public:
+    //Creates a socket pair for every pair of ranks and forks size - 1 children, returns in every process with its own rank.
+    //Has to run before any threads or GL contexts exist.
+    void launch(int size);
+    void cleanup();
+
+    int getRank() override;
+    int getSize() override;
+    bool exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) override;
+private:
+    int rank = 0;
+    int size = 1;
+    std::vector<int> sockets; //one per peer, -1 for this rank
+    std::vector<pid_t> children;
+};
+
+#endif
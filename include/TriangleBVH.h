@@ -0,0 +1,57 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+#include "TriangleMesh.h"
+
+struct NearestHit{
+    glm::vec3 point;
+    float distance = std::numeric_limits<float>::max();
+    uint32_t triangle = UINT32_MAX;
+    int feature = 0; //see TriangleMesh::closestPoint
+};
+
+//Flattened bounding volume hierarchy over a triangle mesh, built with binned SAH
+class TriangleBVH{
+public:
+    static constexpr int binCount = 16;
+    static constexpr int maxLeafSize = 4;
+    static constexpr int maxDepth = 63; //deeper nodes stay leaves, bounds the traversal stack at maxDepth + 1
+
+    //Top levels are split on the calling thread, the subtrees below them are built in parallel
+    void build(ThreadPool* threadPool, const TriangleMesh* mesh);
+
+    //Nearest surface point within maxDistance for a batch of points that lie close together (e.g. one grid cell),
+    //the batch traverses the tree once and only splits up at the leaves
+    void queryNearest(const glm::vec3* points, size_t count, float maxDistance, NearestHit* hits) const;
+
+    size_t getNodeCount();
+private:
+    //32 bytes, children of an inner node are adjacent at leftFirst and leftFirst + 1, leaves index the triangle order
+    struct alignas(32) Node{
+        glm::vec3 min;
+        uint32_t leftFirst;
+        glm::vec3 max;
+        uint32_t count;
+    };
+
+    const TriangleMesh* _mesh = nullptr;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> triangleOrder;
+    std::vector<glm::vec3> triangleMin, triangleMax, centroids;
+
+    void updateBounds(Node& node);
+    void subdivide(std::vector<Node>& tree, uint32_t nodeIndex, int depth, int depthLeft, std::vector<uint32_t>* deferred);
+    bool findSplit(const Node& node, int& axis, float& position);
+
+    static float boxDistance2(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB);
+};
+
+#endif
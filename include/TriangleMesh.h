@@ -0,0 +1,37 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+//Indexed triangle mesh for static geometry, triangles are wound so that their normals face the fluid
+struct TriangleMesh{
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::uvec3> triangles;
+
+    //Wavefront OBJ, only v and f records are read, polygons are fanned into triangles
+    static TriangleMesh loadOBJ(const std::string& filename);
+
+    //Axis aligned box, inward facing when it contains the fluid
+    static TriangleMesh box(const glm::vec3& min, const glm::vec3& max, bool inward);
+
+    glm::vec3 getNormal(size_t triangle) const;
+
+    //Closest point on a triangle, feature is 0 for the face, 1-3 for its vertices and 4-6 for the edges 01, 12, 20
+    glm::vec3 closestPoint(size_t triangle, const glm::vec3& p, int& feature) const;
+    uint64_t hash() const;
+
+    //Points on a world aligned lattice projected onto every triangle along its dominant normal axis,
+    //so coplanar triangles share one lattice and points on shared edges are only kept once
+    std::vector<glm::vec3> sampleSurface(float spacing) const;
+};
+
+#endif
@@ -1,23 +1,33 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+#include <algorithm>
 #include <stdexcept>
+#include <vector>
 
 #include <GLFW/glfw3.h>
 
+#include "Trace.h"
+
 class Window{
 public:
-    void init(int width, int height, const char* title);
+    //Hidden windows only provide a GL context, for headless runs such as the Python bindings
+    void init(int width, int height, const char* title, bool visible = true);
     void cleanup();
 
     void makeContextCurrent();
     bool shouldClose();
     void pollEvents();
+    bool consumeKeyPress(int key);
+    bool isKeyDown(int key);
 
     GLFWwindow* getGLFWWindow();
     
 private:
     GLFWwindow* _window = nullptr;
+    std::vector<int> keyPresses;
+
+    static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 };
 
 #endif
\ No newline at end of file
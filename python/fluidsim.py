@@ -0,0 +1,123 @@
+"""Headless access to the SPH solver from Python.
+
+The particle streams live in persistently mapped GL buffers, every array handed out here is a NumPy view straight
+into them, nothing is copied. Views stay valid for the lifetime of the Simulation and show the state after the
+last step; writing to them changes the particles the next step starts from.
+
+    sim = fluidsim.Simulation("scenes/default.params")
+    for _ in range(100):
+        sim.step()
+        print(sim.positions[:, 1].mean())
+
+The library is looked up as libfluidsim.so in $FLUIDSIM_LIBRARY or the build directory next to this file.
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+_root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+DETERMINISTIC = 1
+SLEEP = 2
+BOUNDARY_PARTICLES = 4
+
+_HOT, _WARM, _COLD = 0, 1, 2
+
+
+def _load_library():
+    path = os.environ.get("FLUIDSIM_LIBRARY", os.path.join(_root, "build", "libfluidsim.so"))
+    library = ctypes.CDLL(path)
+
+    library.fluidsim_create.restype = ctypes.c_void_p
+    library.fluidsim_create.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+    library.fluidsim_destroy.argtypes = [ctypes.c_void_p]
+    library.fluidsim_step.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    library.fluidsim_particle_count.argtypes = [ctypes.c_void_p]
+    library.fluidsim_particle_capacity.argtypes = [ctypes.c_void_p]
+    library.fluidsim_stream.restype = ctypes.POINTER(ctypes.c_float)
+    library.fluidsim_stream.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    library.fluidsim_stiffness.restype = ctypes.c_float
+    library.fluidsim_stiffness.argtypes = [ctypes.c_void_p]
+    library.fluidsim_rest_density.restype = ctypes.c_float
+    library.fluidsim_rest_density.argtypes = [ctypes.c_void_p]
+    library.fluidsim_last_error.restype = ctypes.c_char_p
+    return library
+
+
+_library = _load_library()
+
+
+def _check(result):
+    if result is None or result == -1:
+        raise RuntimeError(_library.fluidsim_last_error().decode())
+    return result
+
+
+class Simulation:
+    def __init__(self, params=None, flags=0, shaders=os.path.join(_root, "shaders")):
+        self._handle = _check(_library.fluidsim_create(params.encode() if params else None, shaders.encode(), flags))
+        capacity = _library.fluidsim_particle_capacity(self._handle)
+
+        #Every stream is capacity rows of four floats, see particle.glsl
+        self._streams = []
+        for stream in (_HOT, _WARM, _COLD):
+            pointer = _library.fluidsim_stream(self._handle, stream)
+            if not pointer:
+                raise RuntimeError(_library.fluidsim_last_error().decode())
+            self._streams.append(np.ctypeslib.as_array(pointer, shape=(capacity, 4)))
+
+        self._count = _check(_library.fluidsim_particle_count(self._handle))
+        self.stiffness = _library.fluidsim_stiffness(self._handle)
+        self.rest_density = _library.fluidsim_rest_density(self._handle)
+
+    def step(self, steps=1):
+        """Advances whole fixed steps of 1/60 s and waits for the GPU"""
+        _check(_library.fluidsim_step(self._handle, steps))
+        self._count = _check(_library.fluidsim_particle_count(self._handle))
+
+    def close(self):
+        if self._handle:
+            self._streams = []
+            _library.fluidsim_destroy(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    @property
+    def count(self):
+        return self._count
+
+    #Views over the live particles, strided into the mapped streams
+    @property
+    def positions(self):
+        return self._streams[_HOT][:self._count, 0:3]
+
+    @property
+    def density(self):
+        return self._streams[_HOT][:self._count, 3]
+
+    @property
+    def velocities(self):
+        return self._streams[_WARM][:self._count, 0:3]
+
+    @property
+    def mass(self):
+        return self._streams[_WARM][:self._count, 3]
+
+    @property
+    def scene(self):
+        return self._streams[_COLD][:self._count, 2]
+
+    @property
+    def pressure(self):
+        """The solver never stores pressure, this is the only array computed on demand"""
+        return np.maximum(0.0001, self.stiffness * (self.density - self.rest_density))
@@ -0,0 +1,12 @@
+#version 450 core
+
+in vec3 normal;
+
+out vec4 outColor;
+
+vec3 lightDirection = normalize(vec3(0.3, 1.0, 0.5));
+
+void main() {
+    float diffuse = max(dot(normalize(normal), lightDirection), 0.0);
+    outColor = vec4(vec3(0.1, 0.3, 0.6) + diffuse * vec3(0.2, 0.5, 0.8), 1.0);
+}
@@ -0,0 +1,24 @@
+#version 450 core
+
+layout (location = 0) in vec3 inPosition;
+layout (location = 1) in vec3 inNormal;
+
+uniform mat4 viewMatrix;
+
+out vec3 normal;
+
+mat4 m = mat4(1.0, 0.0, 0.0, 0.0,
+              0.0, 1.0, 0.0, 0.0,
+              0.0, 0.0, 1.0, 0.0,
+              0.0, 0.0, -1.5, 1.0);
+
+mat4 p = mat4(0.5, 0.0, 0.0, 0.0,
+              0.0, 0.5, 0.0, 0.0,
+              0.0, 0.0, -0.5, -1.0,
+              0.0, 0.0, 0.0, 1.0);
+
+void main() {
+    normal = mat3(viewMatrix * m) * inNormal;
+
+    gl_Position = p * viewMatrix * m * vec4(inPosition, 1.0);
+}
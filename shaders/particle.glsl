@@ -0,0 +1,175 @@
+/* Particle attributes are split into streams by how often the solver touches them:
+     hot  (binding 0): position and density, read by every neighbor loop
+     warm (binding 1): velocity and mass, read by the neighbor loops and the integration
+     cold (binding 2): diagnostics and user attributes, never read by a neighbor loop
+   A shader declares the streams it touches by defining PARTICLE_HOT, PARTICLE_WARM
+   and/or PARTICLE_COLD before including this file, and only those get bound.
+
+   Full mode:    hot  = vec4(position.xyz, density)                       16 bytes
+                 warm = vec4(velocity.xyz, mass)                          16 bytes
+   Compact mode: hot  = uvec2(position.xy as unorm16 over the domain,
+                              position.z as unorm16 | density as fp16)     8 bytes
+                 warm = uvec2(velocity.xy as fp16, velocity.z | mass as fp16) 8 bytes
+   Both modes:   cold = vec4(NaN flag, zero density neighbor, scene, user) 16 bytes
+   The scene is only set in ensemble mode and picks the particle's grid layer and parameters, see sph_common.glsl.
+   Math always runs in fp32, only loads and stores convert.
+
+   The streams are allocated for a fixed capacity, only the first liveCount slots
+   hold particles. The live count and the indirect arguments derived from it stay
+   on the GPU in the simulation state buffer (binding 14).                          */
+
+const vec3 domainMin = vec3(-1, -1, -1);
+const vec3 domainMax = vec3( 1,  1,  1);
+
+layout(std430, binding = 14) buffer simStateBuffer {
+    uvec3 particleDispatch; /* DispatchIndirectCommand over the live particles, 256 wide  */
+    uint liveCount;
+    uvec4 particleDraw;     /* DrawArraysIndirectCommand over the live particles          */
+    uvec3 scanDispatch;     /* DispatchIndirectCommand over the live particles, 1024 wide */
+    uvec3 activeDispatch;   /* DispatchIndirectCommand over the awake particles, see sph_sleep.comp */
+    uint activeCount;
+    uint spawnCount;        /* particles appended by sph_adapt.comp this step, folded into liveCount */
+};
+
+#ifdef DOMAIN_GHOSTS
+//Particles from ownedCount on are read only copies of a neighbor rank's halo, see DomainDecomposition
+uniform uint ownedCount;
+#endif
+
+//Ghosts are only there for the neighbor loops, they are neither simulated nor drawn
+bool isGhost(uint idx) {
+#ifdef DOMAIN_GHOSTS
+    return idx >= ownedCount;
+#else
+    return false;
+#endif
+}
+
+#ifdef PARTICLE_HOT
+
+#ifdef COMPACT_PARTICLES
+
+layout(std430, binding = 0) buffer hotBuffer {
+    uvec2 hot[];
+};
+
+vec3 loadPosition(uint i){
+    vec3 normalized = vec3(unpackUnorm2x16(hot[i].x), unpackUnorm2x16(hot[i].y).x);
+    return domainMin + normalized * (domainMax - domainMin);
+}
+
+void storePosition(uint i, vec3 position){
+    vec3 normalized = clamp((position - domainMin) / (domainMax - domainMin), 0.0, 1.0);
+    hot[i].x = packUnorm2x16(normalized.xy);
+    hot[i].y = (hot[i].y & 0xffff0000u) | (packUnorm2x16(vec2(normalized.z, 0.0)) & 0xffffu);
+}
+
+float loadDensity(uint i){
+    return unpackHalf2x16(hot[i].y).y;
+}
+
+void storeDensity(uint i, float density){
+    hot[i].y = (hot[i].y & 0xffffu) | (packHalf2x16(vec2(0.0, density)) & 0xffff0000u);
+}
+
+#else
+
+layout(std430, binding = 0) buffer hotBuffer {
+    vec4 hot[];
+};
+
+vec3 loadPosition(uint i){
+    return hot[i].xyz;
+}
+
+void storePosition(uint i, vec3 position){
+    hot[i].xyz = position;
+}
+
+float loadDensity(uint i){
+    return hot[i].w;
+}
+
+void storeDensity(uint i, float density){
+    hot[i].w = density;
+}
+
+#endif
+
+#endif
+
+#ifdef PARTICLE_WARM
+
+#ifdef COMPACT_PARTICLES
+
+layout(std430, binding = 1) buffer warmBuffer {
+    uvec2 warm[];
+};
+
+vec3 loadVelocity(uint i){
+    return vec3(unpackHalf2x16(warm[i].x), unpackHalf2x16(warm[i].y).x);
+}
+
+void storeVelocity(uint i, vec3 velocity){
+    warm[i].x = packHalf2x16(velocity.xy);
+    warm[i].y = (warm[i].y & 0xffff0000u) | (packHalf2x16(vec2(velocity.z, 0.0)) & 0xffffu);
+}
+
+float loadMass(uint i){
+    return unpackHalf2x16(warm[i].y).y;
+}
+
+void storeMass(uint i, float mass){
+    warm[i].y = (warm[i].y & 0xffffu) | (packHalf2x16(vec2(0.0, mass)) & 0xffff0000u);
+}
+
+#else
+
+layout(std430, binding = 1) buffer warmBuffer {
+    vec4 warm[];
+};
+
+vec3 loadVelocity(uint i){
+    return warm[i].xyz;
+}
+
+void storeVelocity(uint i, vec3 velocity){
+    warm[i].xyz = velocity;
+}
+
+float loadMass(uint i){
+    return warm[i].w;
+}
+
+void storeMass(uint i, float mass){
+    warm[i].w = mass;
+}
+
+#endif
+
+#endif
+
+#ifdef PARTICLE_COLD
+
+layout(std430, binding = 2) buffer coldBuffer {
+    vec4 cold[];
+};
+
+void markNaN(uint i){
+    cold[i].x = 1.0;
+}
+
+void markZeroDensityNeighbor(uint i, uint neighbor){
+    cold[i].y = float(neighbor);
+}
+
+//Single scene runs never read it, so the cold stream stays out of their other passes
+uint loadScene(uint i){
+#ifdef ENSEMBLE
+    return uint(cold[i].z);
+#else
+    return 0;
+#endif
+}
+
+#endif
@@ -1,10 +1,16 @@
 #version 450 core
 
+#include "sph_params.glsl"
+
 layout (location = 0) in vec3 inPosition;
-layout (location = 2) in vec4 inProperties;
+layout (location = 2) in float inDensity;
 
 uniform mat4 viewMatrix;
 
+//Compact particle storage hands in unorm positions, the culled stream is already decoded
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionBias = vec3(0.0);
+
 out vec4 properties;
 
 mat4 m = mat4(1.0, 0.0, 0.0, 0.0,
@@ -18,8 +24,8 @@ mat4 p = mat4(0.5, 0.0, 0.0, 0.0,
               0.0, 0.0, 0.0, 1.0);
 
 void main() {
-    properties = inProperties;
+    properties = vec4(inDensity, pressureFromDensity(inDensity), 0.0, 0.0);
 
-    gl_Position = p * viewMatrix * m * vec4(inPosition, 1.0);
+    gl_Position = p * viewMatrix * m * vec4(inPosition * positionScale + positionBias, 1.0);
     gl_PointSize = 5.0;
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+/* Grid and kernel helpers shared by the simulation passes */
+
+#include "sph_params.glsl"
+
+layout(std430, binding = 3) buffer gridParticleStartBuffer {
+    uint particleStart[];
+};
+
+layout(std430, binding = 4) buffer gridParticleDataBuffer {
+    uint particleNext[];
+};
+
+#ifdef BOUNDARY_PARTICLES
+
+/* Static boundary particles, sorted by cell and never integrated. x: first particle of the cell, y: count.
+   Each particle is vec4(position, psi), psi is its rest density times sampled volume and acts as a mass. */
+layout(std430, binding = 16) readonly buffer boundaryCellBuffer {
+    uvec2 boundaryCells[];
+};
+
+layout(std430, binding = 17) readonly buffer boundaryParticleBuffer {
+    vec4 boundaryParticles[];
+};
+
+#endif
+
+/* Ensemble mode steps many independent scenes in one dispatch. Each scene owns its own layer of gridLength^3 cells,
+   so neighbor loops never cross into another scene, and its own row of the parameters a calibration sweep varies.
+   Everything else, h, the timestep and the mass, comes from the SimParams block and is shared. */
+struct Scene {
+    float k;
+    float p0;
+    float mu;
+    float damping;
+    vec4 g;
+};
+
+#ifdef ENSEMBLE
+layout(std430, binding = 18) readonly buffer sceneBuffer {
+    Scene scenes[];
+};
+#endif
+
+/* Static boundary distance field, see BoundarySDF, sampled over [boundaryOrigin, boundaryOrigin + boundaryExtent] */
+layout(binding = 2) uniform sampler3D boundarySDF;
+uniform vec3 boundaryOrigin;
+uniform vec3 boundaryExtent;
+
+#ifdef SLEEPING_PARTICLES
+
+/* x: largest motion this step relative to the sleep thresholds (float bits), y: quiet steps, z: sleeping */
+layout(std430, binding = 12) buffer cellSleepBuffer {
+    uvec4 cellSleep[];
+};
+
+layout(std430, binding = 13) buffer activeParticleBuffer {
+    uint activeParticles[];
+};
+
+#endif
+
+uint maxUint = 0xffffffffu;
+vec3 gridMin = domainMin;
+vec3 gridMax = domainMax;
+
+const ivec3 neighborOffsets[27] = {
+    ivec3(-1, -1, -1), ivec3(-1, -1, 0), ivec3(-1, -1, 1),
+    ivec3(-1,  0, -1), ivec3(-1,  0, 0), ivec3(-1,  0, 1),
+    ivec3(-1,  1, -1), ivec3(-1,  1, 0), ivec3(-1,  1, 1),
+    ivec3( 0, -1, -1), ivec3( 0, -1, 0), ivec3( 0, -1, 1),
+    ivec3( 0,  0, -1), ivec3( 0,  0, 0), ivec3( 0,  0, 1),
+    ivec3( 0,  1, -1), ivec3( 0,  1, 0), ivec3( 0,  1, 1),
+    ivec3( 1, -1, -1), ivec3( 1, -1, 0), ivec3( 1, -1, 1),
+    ivec3( 1,  0, -1), ivec3( 1,  0, 0), ivec3( 1,  0, 1),
+    ivec3( 1,  1, -1), ivec3( 1,  1, 0), ivec3( 1,  1, 1),
+};
+
+/* The grid has gridLength cells of size h along each axis, starting at the domain's lower corner */
+bool cellInGrid(ivec3 cell) {
+    int cells = int(gridLength);
+    return cell.x >= 0 && cell.x < cells &&
+           cell.y >= 0 && cell.y < cells &&
+           cell.z >= 0 && cell.z < cells;
+}
+
+ivec3 getCellIndex(vec3 position) {
+    //Clamped, since positions stored on the upper domain face would otherwise land one cell outside
+    return clamp(ivec3(floor((position - domainMin) / h)), ivec3(0), ivec3(int(gridLength) - 1));
+}
+
+uint flattenCellIndex(ivec3 cellIndex) {
+    return uint(cellIndex.x) + gridLength * (uint(cellIndex.y) + gridLength * uint(cellIndex.z));
+}
+
+//First cell of the scene's grid layer, flattened cell indices are relative to it
+uint sceneCellOffset(uint scene) {
+    return scene * gridLength * gridLength * gridLength;
+}
+
+Scene sceneParams(uint scene) {
+#ifdef ENSEMBLE
+    return scenes[scene];
+#else
+    return Scene(k, p0, mu, damping, vec4(g, 0.0));
+#endif
+}
+
+float pressureFromDensity(float density, Scene scene) {
+    return max(0.0001, scene.k * (density - scene.p0));
+}
+
+//Maps the invocation to a particle, with sleeping enabled only the awake ones are visited
+bool fetchParticle(out uint idx) {
+#ifdef SLEEPING_PARTICLES
+    if(gl_GlobalInvocationID.x >= activeCount) return false;
+    idx = activeParticles[gl_GlobalInvocationID.x];
+#else
+    idx = gl_GlobalInvocationID.x;
+    if(idx >= liveCount) return false;
+#endif
+    return true;
+}
+
+bool particleSleeping(vec3 position) {
+#ifdef SLEEPING_PARTICLES
+    return cellSleep[flattenCellIndex(getCellIndex(position))].z != 0;
+#else
+    return false;
+#endif
+}
+
+//Motion is relative to the sleep thresholds, positive floats order like their bits
+void recordMotion(vec3 position, float motion) {
+#ifdef SLEEPING_PARTICLES
+    atomicMax(cellSleep[flattenCellIndex(getCellIndex(position))].x, floatBitsToUint(motion));
+#endif
+}
+
+//xyz: unit normal pointing away from the boundary, w: signed distance, negative inside solids
+vec4 sampleBoundary(vec3 position) {
+    vec4 boundary = texture(boundarySDF, (position - boundaryOrigin) / boundaryExtent);
+    float normalLength = length(boundary.xyz);
+    return vec4(normalLength > 0.0 ? boundary.xyz / normalLength : vec3(0.0), boundary.w);
+}
+
+//Smoothing length of a particle, volume per particle follows its mass so h scales with its cube root
+float smoothingLength(float particleMass) {
+    return h * pow(particleMass / mass, 1.0 / 3.0);
+}
+
+float poly6(float r, float h) {
+    return 315.0 / 64.0 / pi / pow(h, 9) * pow(h*h - r*r, 3);
+}
+
+vec3 g_spiky(vec3 rij, float r, float h) {
+    return -45.0 / pi / pow(h, 6) / r * (h - r) * (h - r) * rij;
+}
+
+float g2_spiky(float r, float h) {
+    return 45.0 / pi / pow(h, 6) * (h-r);
+}
@@ -0,0 +1,34 @@
+/* Solver parameters shared by the simulation passes and the renderer. They live in one std140 block that
+   mirrors SimParamsBlock in Solver.h and is refilled from SimParams between steps, so nothing recompiles. */
+
+layout(std140, binding = 0) uniform SimParams {
+    vec3 g;                   /* gravitational acceleration vector */
+    float timestep;           /* substep length                    */
+    float h;                  /* smoothing length and cell size    */
+    float k;                  /* Gas Stiffness Constant            */
+    float p0;                 /* Rest Density                      */
+    float mu;                 /* Viscosity Coefficient             */
+    float mass;               /* Base particle mass, split particles carry 1/2, 1/4 or 1/8 of it */
+    float minMass;            /* mass / 8                          */
+    float damping;
+
+    /* Sleeping, a cell is quiet while its particles move slower than sleepVelocity and their density
+       changes by less than sleepDensityChange * p0 per substep, after sleepSteps quiet steps it sleeps */
+    float sleepVelocity;
+    float sleepDensityChange;
+    uint sleepSteps;
+
+    /* Adaptive resolution, particles split below splitDensity * p0 or within a smoothing length of a wall
+       and merge above mergeDensity * p0 and more than two smoothing lengths away from the walls        */
+    float splitDensity;
+    float mergeDensity;
+
+    uint gridLength;          /* cells along each axis of the neighbor grid, ceil(2 / h) */
+};
+
+float pi = 3.1415926538;
+
+/* Equation of state, pressure is never stored since it follows from the density */
+float pressureFromDensity(float density){
+    return max(0.0001, k * (density - p0));
+}
@@ -0,0 +1,160 @@
+#include "BoundarySDF.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+void BoundarySDF::build(ThreadPool* threadPool, const TriangleMesh& mesh, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const std::string& cacheFile){
+    origin = boundsMin;
+    extent = boundsMax - boundsMin;
+
+    CacheHeader header;
+    std::memcpy(header.magic, "SDF1", 4);
+    header.resolution = resolution;
+    header.meshHash = mesh.hash();
+    header.origin = origin;
+    header.extent = extent;
+
+    if(mesh.triangles.empty()){
+        throw std::runtime_error("Boundary mesh has no triangles");
+    }
+
+    if(!cacheFile.empty() && loadCache(cacheFile, header)){
+        std::cout << "Boundary SDF: loaded " << cacheFile << std::endl;
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    _mesh = &mesh;
+    computePseudoNormals();
+
+    TriangleBVH bvh;
+    bvh.build(threadPool, &mesh);
+
+    //Bricks of voxels query the hierarchy together, so neighboring voxels share one traversal
+    samples.resize(resolution * resolution * resolution);
+    glm::vec3 spacing = extent / (float)resolution;
+    int bricks = resolution / brickSize;
+
+    threadPool->parallelFor(bricks * bricks * bricks, [&](size_t begin, size_t end){
+        glm::vec3 points[brickSize * brickSize * brickSize];
+        NearestHit hits[brickSize * brickSize * brickSize];
+
+        for(size_t brick = begin; brick < end; brick++){
+            glm::ivec3 brickOrigin = glm::ivec3(brick % bricks, (brick / bricks) % bricks, brick / (bricks * bricks)) * brickSize;
+
+            for(int i = 0; i < brickSize * brickSize * brickSize; i++){
+                glm::ivec3 voxel = brickOrigin + glm::ivec3(i % brickSize, (i / brickSize) % brickSize, i / (brickSize * brickSize));
+                points[i] = origin + (glm::vec3(voxel) + 0.5f) * spacing;
+            }
+
+            bvh.queryNearest(points, brickSize * brickSize * brickSize, std::numeric_limits<float>::max(), hits);
+
+            for(int i = 0; i < brickSize * brickSize * brickSize; i++){
+                glm::ivec3 voxel = brickOrigin + glm::ivec3(i % brickSize, (i / brickSize) % brickSize, i / (brickSize * brickSize));
+                samples[voxel.x + resolution * (voxel.y + resolution * voxel.z)] = evaluate(points[i], hits[i]);
+            }
+        }
+    });
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Boundary SDF: baked " << mesh.triangles.size() << " triangles (" << bvh.getNodeCount() << " BVH nodes) at "
+              << resolution << "^3 in " << elapsed.count() << " ms" << std::endl;
+
+    if(!cacheFile.empty()) storeCache(cacheFile, header);
+    _mesh = nullptr;
+}
+
+const std::vector<glm::vec4>& BoundarySDF::getSamples(){
+    return samples;
+}
+
+glm::vec3 BoundarySDF::getOrigin(){
+    return origin;
+}
+
+glm::vec3 BoundarySDF::getExtent(){
+    return extent;
+}
+
+void BoundarySDF::computePseudoNormals(){
+    const TriangleMesh& mesh = *_mesh;
+
+    faceNormals.resize(mesh.triangles.size());
+    vertexNormals.assign(mesh.vertices.size(), glm::vec3(0.0f));
+    edgeNormals.clear();
+
+    for(size_t i = 0; i < mesh.triangles.size(); i++){
+        const glm::uvec3& t = mesh.triangles[i];
+        glm::vec3 normal = glm::cross(mesh.vertices[t.y] - mesh.vertices[t.x], mesh.vertices[t.z] - mesh.vertices[t.x]);
+
+        //Degenerate triangles can still be closest, they just carry no orientation
+        float length = glm::length(normal);
+        if(length == 0.0f){
+            faceNormals[i] = glm::vec3(0.0f);
+            continue;
+        }
+        normal /= length;
+        faceNormals[i] = normal;
+
+        //Vertices weight each face by its corner angle, edges sum their two faces
+        for(int corner = 0; corner < 3; corner++){
+            uint32_t v = t[corner], next = t[(corner + 1) % 3], previous = t[(corner + 2) % 3];
+            glm::vec3 e0 = glm::normalize(mesh.vertices[next] - mesh.vertices[v]);
+            glm::vec3 e1 = glm::normalize(mesh.vertices[previous] - mesh.vertices[v]);
+            vertexNormals[v] += std::acos(glm::clamp(glm::dot(e0, e1), -1.0f, 1.0f)) * normal;
+
+            edgeNormals[std::minmax(v, next)] += normal;
+        }
+    }
+}
+
+glm::vec4 BoundarySDF::evaluate(const glm::vec3& point, const NearestHit& hit){
+    const glm::uvec3& t = _mesh->triangles[hit.triangle];
+
+    glm::vec3 pseudoNormal;
+    if(hit.feature == 0) pseudoNormal = faceNormals[hit.triangle];
+    else if(hit.feature <= 3) pseudoNormal = vertexNormals[t[hit.feature - 1]];
+    else{
+        auto edge = edgeNormals.find(std::minmax(t[hit.feature - 4], t[(hit.feature - 3) % 3]));
+        pseudoNormal = edge != edgeNormals.end() ? edge->second : glm::vec3(0.0f);
+    }
+
+    float distance = hit.distance;
+    glm::vec3 closest = hit.point;
+    float sign = glm::dot(point - closest, pseudoNormal) >= 0.0f ? 1.0f : -1.0f;
+    glm::vec3 normal = distance > 1e-6f || glm::length(pseudoNormal) == 0.0f ? sign * (point - closest) / std::max(distance, 1e-6f) : glm::normalize(pseudoNormal);
+
+    return glm::vec4(normal, sign * distance);
+}
+
+bool BoundarySDF::loadCache(const std::string& cacheFile, const CacheHeader& expected){
+    std::ifstream file(cacheFile, std::ios::binary);
+    if(!file.is_open()) return false;
+
+    CacheHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!file || std::memcmp(header.magic, expected.magic, 4) != 0 || header.resolution != expected.resolution ||
+       header.meshHash != expected.meshHash || header.origin != expected.origin || header.extent != expected.extent){
+        return false;
+    }
+
+    samples.resize(resolution * resolution * resolution);
+    file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(glm::vec4));
+    return (bool)file;
+}
+
+void BoundarySDF::storeCache(const std::string& cacheFile, const CacheHeader& header){
+    std::ofstream file(cacheFile, std::ios::binary);
+
+    //A missing cache only costs the bake on the next start
+    if(!file.is_open()){
+        std::cerr << "Boundary SDF: could not write " << cacheFile << std::endl;
+        return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(glm::vec4));
+}
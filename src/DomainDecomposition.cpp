@@ -0,0 +1,218 @@
+#include "DomainDecomposition.h"
+
+void DomainDecomposition::init(Transport* transport, SPH* solver){
+    this->transport = transport;
+    this->solver = solver;
+    rank = transport->getRank();
+    size = transport->getSize();
+
+    for(int r = 0; r < size; r++){
+        if(r != rank) peers.push_back(r);
+    }
+
+    //Equal widths until the first rebalance
+    cuts.resize(size + 1);
+    for(int r = 0; r <= size; r++){
+        cuts[r] = SPH::domainMin + (SPH::domainMax - SPH::domainMin) * r / size;
+    }
+
+    solver->setDomainGhosts(true);
+    solver->setStepHook([this](){ step(); });
+}
+
+void DomainDecomposition::cleanup(){
+    solver->setStepHook(nullptr);
+}
+
+bool DomainDecomposition::isRunning(){
+    return running;
+}
+
+void DomainDecomposition::step(){
+    if(!running) return;
+
+    //Rank 0's initial particles are the scene, every other rank starts from its share of them
+    if(!distributed){
+        distribute();
+        distributed = true;
+        return;
+    }
+
+    if(++steps % rebalanceInterval == 0) rebalance();
+    exchangeParticles();
+}
+
+float DomainDecomposition::getHaloWidth(){
+    //Ghosts stay frozen for the substeps of a step, so the halo also covers the support of the ghosts' own densities
+    return 2.0f * solver->getParams().h;
+}
+
+int DomainDecomposition::getOwner(float x){
+    int owner = std::upper_bound(cuts.begin() + 1, cuts.end() - 1, x) - (cuts.begin() + 1);
+    return owner;
+}
+
+void DomainDecomposition::append(std::vector<char>& message, const particle& p){
+    size_t offset = message.size();
+    message.resize(offset + sizeof(particle));
+    std::memcpy(message.data() + offset, &p, sizeof(particle));
+}
+
+bool DomainDecomposition::exchange(){
+    if(transport->exchange(peers, outgoing, incoming)) return true;
+
+    std::cerr << "Rank " << rank << ": a peer disconnected, stopping the simulation" << std::endl;
+    running = false;
+    return false;
+}
+
+void DomainDecomposition::distribute(){
+    outgoing.assign(peers.size(), std::vector<char>());
+    particles.clear();
+
+    if(rank == 0){
+        for(const particle& p : solver->getInitialParticles()){
+            int owner = getOwner(p.position.x);
+            if(owner == 0) particles.push_back(p);
+            else append(outgoing[owner - 1], p);
+        }
+    }
+
+    if(!exchange()) return;
+
+    if(rank != 0){
+        const std::vector<char>& message = incoming[0];
+        size_t count = message.size() / sizeof(particle);
+        particles.resize(count);
+        std::memcpy(particles.data(), message.data(), message.size());
+    }
+
+    ownedCount = particles.size();
+    solver->writeParticles(particles, ownedCount);
+}
+
+void DomainDecomposition::exchangeParticles(){
+    //Only the owned prefix is current, last step's ghosts are replaced by fresh copies
+    solver->readParticles(particles);
+    particles.resize(ownedCount);
+
+    //Each message is the migrant count followed by the migrants and then the ghosts
+    outgoing.assign(peers.size(), std::vector<char>(sizeof(uint32_t), 0));
+    std::vector<uint32_t> migrants(peers.size(), 0);
+    std::vector<std::vector<char>> ghosts(peers.size());
+
+    float haloWidth = getHaloWidth();
+    std::vector<particle> owned, localGhosts;
+    owned.reserve(particles.size());
+
+    for(const particle& p : particles){
+        float x = p.position.x;
+        int owner = getOwner(x);
+
+        for(size_t i = 0; i < peers.size(); i++){
+            int peer = peers[i];
+            if(peer == owner){
+                append(outgoing[i], p);
+                migrants[i]++;
+            }else if(x >= cuts[peer] - haloWidth && x < cuts[peer + 1] + haloWidth){
+                append(ghosts[i], p);
+            }
+        }
+
+        //A particle that just left still sits in this rank's halo, its new owner only sends it back next step
+        if(owner == rank) owned.push_back(p);
+        else if(x >= cuts[rank] - haloWidth && x < cuts[rank + 1] + haloWidth) localGhosts.push_back(p);
+    }
+
+    for(size_t i = 0; i < peers.size(); i++){
+        std::memcpy(outgoing[i].data(), &migrants[i], sizeof(uint32_t));
+        outgoing[i].insert(outgoing[i].end(), ghosts[i].begin(), ghosts[i].end());
+    }
+
+    if(!exchange()) return;
+
+    //Received migrants join the owned prefix, everything else is appended as ghosts
+    for(const std::vector<char>& message : incoming){
+        uint32_t count;
+        std::memcpy(&count, message.data(), sizeof(uint32_t));
+        const particle* received = reinterpret_cast<const particle*>(message.data() + sizeof(uint32_t));
+        owned.insert(owned.end(), received, received + count);
+    }
+
+    ownedCount = owned.size();
+    particles = std::move(owned);
+    particles.insert(particles.end(), localGhosts.begin(), localGhosts.end());
+
+    for(const std::vector<char>& message : incoming){
+        uint32_t count;
+        std::memcpy(&count, message.data(), sizeof(uint32_t));
+        size_t total = (message.size() - sizeof(uint32_t)) / sizeof(particle);
+        const particle* received = reinterpret_cast<const particle*>(message.data() + sizeof(uint32_t));
+        particles.insert(particles.end(), received + count, received + total);
+    }
+
+    solver->writeParticles(particles, ownedCount);
+
+    if(steps % reportInterval == 0 && rank == 0){
+        std::cout << "Rank 0: " << ownedCount << " owned, " << particles.size() - ownedCount << " ghosts" << std::endl;
+    }
+}
+
+void DomainDecomposition::rebalance(){
+    //Everyone shares a histogram of its owned x coordinates and derives the same equal count cuts from the sum
+    std::vector<uint32_t> histogram(histogramBins, 0);
+    float binWidth = (SPH::domainMax - SPH::domainMin) / histogramBins;
+
+    solver->readParticles(particles);
+    for(int i = 0; i < ownedCount; i++){
+        int bin = std::clamp((int)((particles[i].position.x - SPH::domainMin) / binWidth), 0, histogramBins - 1);
+        histogram[bin]++;
+    }
+
+    std::vector<char> message(histogramBins * sizeof(uint32_t));
+    std::memcpy(message.data(), histogram.data(), message.size());
+    outgoing.assign(peers.size(), message);
+
+    if(!exchange()) return;
+
+    //Integer sums make the result independent of the order ranks are added in
+    std::vector<uint64_t> total(histogram.begin(), histogram.end());
+    std::vector<uint64_t> counts(size, 0);
+    counts[rank] = ownedCount;
+    for(size_t i = 0; i < peers.size(); i++){
+        const uint32_t* received = reinterpret_cast<const uint32_t*>(incoming[i].data());
+        for(int bin = 0; bin < histogramBins; bin++){
+            total[bin] += received[bin];
+            counts[peers[i]] += received[bin];
+        }
+    }
+
+    uint64_t particleTotal = 0;
+    for(uint64_t count : total) particleTotal += count;
+    if(particleTotal == 0) return;
+
+    //Place each cut where the cumulative count crosses its share, interpolating inside the bin
+    uint64_t cumulative = 0;
+    int bin = 0;
+    for(int r = 1; r < size; r++){
+        double target = (double)particleTotal * r / size;
+        while(bin < histogramBins && cumulative + total[bin] < target){
+            cumulative += total[bin];
+            bin++;
+        }
+
+        double fraction = bin < histogramBins && total[bin] > 0 ? (target - cumulative) / total[bin] : 0.0;
+        cuts[r] = std::max(cuts[r - 1], (float)(SPH::domainMin + (bin + fraction) * binWidth));
+    }
+
+    if(rank == 0){
+        uint64_t largest = *std::max_element(counts.begin(), counts.end());
+        double mean = (double)particleTotal / size;
+
+        std::cout << "Rebalanced " << size << " ranks, particles per rank before:";
+        for(uint64_t count : counts) std::cout << " " << count;
+        std::cout << ", imbalance " << std::fixed << std::setprecision(2) << largest / mean << std::defaultfloat << ", cuts:";
+        for(int r = 1; r < size; r++) std::cout << " " << cuts[r];
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,162 @@
+#include "EntropyCoder.h"
+
+int EntropyCoder::bitLength(uint32_t value){
+    return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+void EntropyCoder::normalizeFrequencies(const uint32_t* counts, uint16_t* frequencies){
+    //Scale to the probability range, every symbol that occurs keeps at least one slot
+    const uint32_t range = 1u << probabilityBits;
+    uint64_t total = 0;
+    for(int s = 0; s < symbolCount; s++) total += counts[s];
+
+    uint32_t sum = 0;
+    for(int s = 0; s < symbolCount; s++){
+        frequencies[s] = total == 0 ? 0 : counts[s] == 0 ? 0 : std::max<uint32_t>(1, counts[s] * range / total);
+        sum += frequencies[s];
+    }
+    if(total == 0){
+        frequencies[0] = range;
+        return;
+    }
+
+    //Rounding leaves the sum a few slots off, the most frequent symbols absorb the difference
+    while(sum != range){
+        int largest = 0;
+        for(int s = 1; s < symbolCount; s++){
+            if(frequencies[s] > frequencies[largest]) largest = s;
+        }
+        if(sum < range){
+            frequencies[largest]++;
+            sum++;
+        }else{
+            frequencies[largest]--;
+            sum--;
+        }
+    }
+}
+
+void EntropyCoder::encode(const uint32_t* values, size_t count, std::vector<uint8_t>& out){
+    uint32_t counts[symbolCount] = {};
+    std::vector<uint8_t> symbols(count);
+    for(size_t i = 0; i < count; i++){
+        symbols[i] = bitLength(values[i]);
+        counts[symbols[i]]++;
+    }
+
+    uint16_t frequencies[symbolCount];
+    uint32_t starts[symbolCount];
+    normalizeFrequencies(counts, frequencies);
+    for(int s = 0, start = 0; s < symbolCount; s++){
+        starts[s] = start;
+        start += frequencies[s];
+    }
+
+    //Bits below the leading one, in order
+    std::vector<uint8_t> raw;
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+    for(size_t i = 0; i < count; i++){
+        int extraBits = symbols[i] - 1;
+        if(extraBits <= 0) continue;
+
+        bitBuffer |= uint64_t(values[i] & ((1u << extraBits) - 1)) << bitCount;
+        bitCount += extraBits;
+        while(bitCount >= 8){
+            raw.push_back(bitBuffer & 0xff);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+    if(bitCount > 0) raw.push_back(bitBuffer & 0xff);
+
+    //rANS runs backwards over the symbols and emits its bytes back to front, the decoder then reads both forwards
+    std::vector<uint8_t> rans;
+    uint32_t state = ransLow;
+    for(size_t i = count; i-- > 0;){
+        uint32_t frequency = frequencies[symbols[i]];
+        uint32_t stateMax = ((ransLow >> probabilityBits) << 8) * frequency;
+        while(state >= stateMax){
+            rans.push_back(state & 0xff);
+            state >>= 8;
+        }
+        state = ((state / frequency) << probabilityBits) + (state % frequency) + starts[symbols[i]];
+    }
+    for(int shift = 24; shift >= 0; shift -= 8) rans.push_back(state >> shift);
+    std::reverse(rans.begin(), rans.end());
+
+    //Little endian hosts only, like the rest of the file formats
+    uint32_t ransBytes = rans.size(), rawBytes = raw.size();
+    size_t offset = out.size();
+    out.resize(offset + sizeof(frequencies) + 2 * sizeof(uint32_t) + rans.size() + raw.size());
+    uint8_t* cursor = out.data() + offset;
+    std::memcpy(cursor, frequencies, sizeof(frequencies));
+    cursor += sizeof(frequencies);
+    std::memcpy(cursor, &ransBytes, sizeof(uint32_t));
+    cursor += sizeof(uint32_t);
+    std::memcpy(cursor, &rawBytes, sizeof(uint32_t));
+    cursor += sizeof(uint32_t);
+    std::memcpy(cursor, rans.data(), rans.size());
+    std::memcpy(cursor + rans.size(), raw.data(), raw.size());
+}
+
+void EntropyCoder::decode(const uint8_t* data, size_t size, uint32_t* values, size_t count){
+    uint16_t frequencies[symbolCount];
+    uint32_t ransBytes, rawBytes;
+    size_t headerSize = sizeof(frequencies) + 2 * sizeof(uint32_t);
+    if(size < headerSize) throw std::runtime_error("Truncated entropy coded chunk");
+
+    std::memcpy(frequencies, data, sizeof(frequencies));
+    std::memcpy(&ransBytes, data + sizeof(frequencies), sizeof(uint32_t));
+    std::memcpy(&rawBytes, data + sizeof(frequencies) + sizeof(uint32_t), sizeof(uint32_t));
+    if(ransBytes < 4 || headerSize + size_t(ransBytes) + rawBytes > size) throw std::runtime_error("Malformed entropy coded chunk");
+
+    //Slot to symbol lookup over the whole probability range
+    uint32_t starts[symbolCount];
+    std::vector<uint8_t> lookup(1u << probabilityBits);
+    uint32_t start = 0;
+    for(int s = 0; s < symbolCount; s++){
+        starts[s] = start;
+        if(start + frequencies[s] > lookup.size()) throw std::runtime_error("Malformed entropy coded chunk");
+        std::fill(lookup.begin() + start, lookup.begin() + start + frequencies[s], s);
+        start += frequencies[s];
+    }
+    if(start != lookup.size()) throw std::runtime_error("Malformed entropy coded chunk");
+
+    const uint8_t* rans = data + headerSize;
+    const uint8_t* ransEnd = rans + ransBytes;
+    const uint8_t* raw = ransEnd;
+    const uint8_t* rawEnd = raw + rawBytes;
+
+    uint32_t state = rans[0] | rans[1] << 8 | rans[2] << 16 | uint32_t(rans[3]) << 24;
+    rans += 4;
+
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+    const uint32_t mask = (1u << probabilityBits) - 1;
+
+    for(size_t i = 0; i < count; i++){
+        uint32_t slot = state & mask;
+        int symbol = lookup[slot];
+        state = frequencies[symbol] * (state >> probabilityBits) + slot - starts[symbol];
+        while(state < ransLow){
+            if(rans == ransEnd) throw std::runtime_error("Truncated rANS stream");
+            state = state << 8 | *rans++;
+        }
+
+        int extraBits = symbol - 1;
+        if(extraBits <= 0){
+            values[i] = symbol;
+            continue;
+        }
+
+        while(bitCount < extraBits){
+            if(raw == rawEnd) throw std::runtime_error("Truncated raw bit stream");
+            bitBuffer |= uint64_t(*raw++) << bitCount;
+            bitCount += 8;
+        }
+        values[i] = (1u << extraBits) | uint32_t(bitBuffer & ((1u << extraBits) - 1));
+        bitBuffer >>= extraBits;
+        bitCount -= extraBits;
+    }
+}
@@ -1,30 +1,438 @@
 #include "FluidSim.h"
 
+void FluidSim::parseArguments(int argc, char** argv) {
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+
+        //Harness and reporting options do not change the simulation, everything else is part of the scene
+        if(arg == "--record" && i + 1 < argc){
+            harnessMode = HARNESS_RECORD;
+            harnessFile = argv[++i];
+            continue;
+        }else if(arg == "--compare" && i + 1 < argc){
+            harnessMode = HARNESS_COMPARE;
+            harnessFile = argv[++i];
+            continue;
+        }else if(arg == "--report" && i + 1 < argc){
+            reportFile = argv[++i];
+            continue;
+        }else if(arg == "--steps" && i + 1 < argc){
+            harnessSteps = std::stoi(argv[++i]);
+            continue;
+        }else if(arg == "--tolerance" && i + 1 < argc){
+            performanceTolerance = std::stod(argv[++i]);
+            continue;
+        }else if(arg == "--physics-tolerance" && i + 1 < argc){
+            physicsTolerance = std::stod(argv[++i]);
+            continue;
+        }else if(arg == "--publish" && i + 1 < argc){
+            publishName = argv[++i];
+            continue;
+        }else if(arg == "--trajectory" && i + 1 < argc){
+            trajectoryFile = argv[++i];
+            continue;
+        }else if(arg == "--trajectory-error" && i + 1 < argc){
+            trajectoryError = std::stof(argv[++i]);
+            continue;
+        }else if(arg == "--export" && i + 1 < argc){
+            exportFormat = ParticleExporter::parseFormat(argv[++i]);
+            exporting = true;
+            continue;
+        }else if(arg == "--export-attributes" && i + 1 < argc){
+            exportAttributes = ParticleExporter::parseAttributes(argv[++i]);
+            continue;
+        }else if(arg == "--export-interval" && i + 1 < argc){
+            exportInterval = std::stoi(argv[++i]);
+            continue;
+        }else if(arg == "--trace" && i + 1 < argc){
+            traceFile = argv[++i];
+            continue;
+        }else if(arg == "--replay" && i + 1 < argc){
+            replayFile = argv[++i];
+            continue;
+        }else if(arg == "--thread-stats"){
+            threadStats = true;
+            continue;
+        }else if(arg == "--grid-stats" && i + 1 < argc){
+            solver.setGridStatistics(std::stoi(argv[++i]));
+            continue;
+        }else if(arg == "--params" && i + 1 < argc){
+            paramFiles.push_back(argv[++i]);
+            paramSets.push_back(SimParams::load(paramFiles.back()));
+            continue;
+        }
+
+        scene += (scene.empty() ? "" : " ") + arg;
+
+        if(arg == "--compact"){
+            solver.setCompactStorage(true);
+        }else if(arg == "--sleep"){
+            solver.setSleeping(true);
+        }else if(arg == "--boundary" && i + 1 < argc){
+            solver.setBoundaryMesh(argv[++i]);
+            scene += " " + std::string(argv[i]);
+        }else if(arg == "--boundary-particles"){
+            solver.setBoundaryParticles(true);
+        }else if(arg == "--adaptive"){
+            solver.setParticleCapacity(std::max(solver.getParticleCapacity(), ADAPTIVE_CAPACITY));
+            solver.setAdaptiveResolution(true);
+        }else if(arg == "--inflow"){
+            //Jet from the top into a drain in the floor, the live count settles where inflow meets outflow
+            solver.setParticleCapacity(std::max(solver.getParticleCapacity(), INFLOW_CAPACITY));
+            solver.addEmitter({glm::vec3(0.0f, 0.8f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), 0.1f, 600.0f});
+            solver.addSink({SINK_BOX, glm::vec4(-0.25f, -1.1f, -0.25f, 0.0f), glm::vec4(0.25f, -0.95f, 0.25f, 0.0f)});
+        }else if(arg == "--deterministic"){
+            solver.setDeterministic(true);
+        }else if(arg == "--numa"){
+            threadPool.setPinned(true);
+        }else if(arg == "--ensemble"){
+            ensemble = true;
+        }else if(arg == "--ranks" && i + 1 < argc){
+            ranks = std::stoi(argv[++i]);
+            scene += " " + std::to_string(ranks);
+            if(ranks < 1) throw std::runtime_error("--ranks needs at least one rank");
+        }else{
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    //Ensemble scenes share the streams back to back, otherwise they are sized for the largest parameter set,
+    //so switching sets never reallocates them
+    if(ensemble){
+        if(paramSets.empty()) throw std::runtime_error("--ensemble needs the scenes as --params files");
+        if(ranks > 1) throw std::runtime_error("--ensemble needs a single rank");
+        solver.setEnsemble(paramSets);
+    }else if(!paramSets.empty()){
+        int largest = 0;
+        for(const SimParams& params : paramSets) largest = std::max(largest, params.particleCount);
+        solver.setParticleCapacity(std::max(solver.getParticleCapacity(), largest));
+        solver.setParams(paramSets[0]);
+        if(ranks > 1 && paramSets.size() > 1) throw std::runtime_error("Multiple parameter sets need a single rank");
+    }
+
+    if(!replayFile.empty()){
+        if(ranks > 1 || ensemble || harnessMode != HARNESS_OFF) throw std::runtime_error("--replay runs a single rank without --ensemble or the harness");
+        if(!trajectoryFile.empty()) throw std::runtime_error("--replay cannot record a trajectory at the same time");
+    }
+
+    //References are only worth comparing when runs repeat, adaptive resolution cannot and relies on the physics tolerance
+    if(harnessMode != HARNESS_OFF){
+        if(ranks > 1) throw std::runtime_error("The regression harness runs a single rank");
+        if(!solver.isAdaptiveResolution()) solver.setDeterministic(true);
+        if(reportFile.empty()) reportFile = harnessFile + ".report.txt";
+    }
+}
+
 void FluidSim::run() {
+    //Fork before any thread or GL context exists, every rank then runs the rest on its own
+    if(ranks > 1) transport.launch(ranks);
+
+    //Recording starts before init so loading shaders and building the scene show up too
+    if(!traceFile.empty()){
+        Trace::start();
+        TRACE_THREAD_NAME("main");
+    }
+
     init();
-    mainLoop();
+    if(harnessMode != HARNESS_OFF){
+        runHarness();
+    }else if(!replayFile.empty()){
+        //A frame that fails to decode ends playback, the decoder thread has to be joined before the error is reported
+        try{
+            replayLoop();
+        }catch(...){
+            cleanup();
+            throw;
+        }
+    }else{
+        mainLoop();
+    }
     cleanup();
 }
 
 void FluidSim::init() {
-    window.init(WIDTH, HEIGHT, "3D SPH Fluid Sim");
-    solver.init();
+    TRACE_ZONE("FluidSim::init");
+    std::string title = "3D SPH Fluid Sim";
+    if(ranks > 1){
+        title += " (rank " + std::to_string(transport.getRank()) + " of " + std::to_string(ranks) + ")";
+        decomposition.init(&transport, &solver);
+    }
+
+    window.init(WIDTH, HEIGHT, title.c_str());
+    threadPool.init();
+    if(threadPool.isPinned()) threadPool.reportNodeBandwidth();
+
+    //The streams have to hold the trajectory's largest frame, the solver itself never steps
+    if(!replayFile.empty()){
+        player.init(replayFile);
+        solver.setParticleCapacity(std::max<int>(solver.getParticleCapacity(), player.getMaxParticleCount()));
+        std::cout << "Replaying " << replayFile << ": " << player.getFrameCount() << " frames of up to " << player.getMaxParticleCount() << " particles" << std::endl;
+    }
+
+    solver.init(&threadPool);
     renderer.init(window.getGLFWWindow(), &solver);
+
+    const SimParams& params = solver.getParams();
+    surfaceExtractor.init(&threadPool, params.h / 4.0f, params.h, 0.5f, params.mass);
+    renderer.setSurfaceMesh(&surfaceExtractor.getMesh());
+
+    //Every rank gets its own ring, named after it
+    if(!publishName.empty()){
+        std::string name = ranks > 1 ? publishName + "." + std::to_string(transport.getRank()) : publishName;
+        publisher.init(name, solver.getParticleCapacity(), PUBLISH_SLOTS);
+    }
+
+    if(!trajectoryFile.empty()){
+        std::string file = ranks > 1 ? trajectoryFile + "." + std::to_string(transport.getRank()) : trajectoryFile;
+        trajectory.init(&threadPool, file, SPH::domainMin, SPH::domainMax, trajectoryError, TRAJECTORY_KEYFRAMES);
+    }
+
+    if(exporting) exporter.init(&threadPool, exportFormat, exportAttributes);
 }
 
 void FluidSim::mainLoop() {
-    while(!window.shouldClose()){
+    while(!window.shouldClose() && (ranks == 1 || decomposition.isRunning())){
+        TRACE_ZONE("FluidSim::frame");
 
         solver.mainLoop();
 
+        //Only frames the solver advanced are read back, a display faster than the fixed step would otherwise
+        //publish and record the same state several times. Ghosts belong to the neighbor rank's frame
+        bool advanced = solver.getSimulatedTime() != recordedTime;
+        if(advanced && (!publishName.empty() || !trajectoryFile.empty())){
+            {
+                TRACE_ZONE("FluidSim::readback");
+                solver.readParticles(particleCache);
+                if(ranks > 1) particleCache.resize(solver.getOwnedCount());
+            }
+
+            if(!publishName.empty()) publisher.publish(particleCache, solver.getSimulatedTime());
+
+            if(!trajectoryFile.empty()){
+                TRACE_ZONE("FluidSim::trajectory");
+                trajectoryPositions.resize(particleCache.size());
+                for(size_t i = 0; i < particleCache.size(); i++) trajectoryPositions[i] = glm::vec3(particleCache[i].position);
+                trajectory.writeFrame(trajectoryPositions, solver.getSimulatedTime());
+            }
+
+            recordedTime = solver.getSimulatedTime();
+        }
+
+        if(window.consumeKeyPress(GLFW_KEY_M)) renderer.cycleRenderMode();
+        if(window.consumeKeyPress(GLFW_KEY_P) && paramSets.size() > 1){
+            size_t next = (currentParams + 1) % paramSets.size();
+            if(ensemble){
+                currentParams = next;
+                renderer.setSurfaceScene(next);
+                std::cout << "Surface scene: " << paramFiles[next] << std::endl;
+            }else{
+                applyParams(next);
+            }
+        }
+
+        if(renderer.getRenderMode() == RENDER_MESH && frame % SURFACE_INTERVAL == 0) extractSurface(currentParams);
+
+        if(window.consumeKeyPress(GLFW_KEY_E)){
+            exportSurfaces();
+            if(exporting) exportParticles();
+        }else if(exporting && exportInterval > 0 && frame % exportInterval == 0){
+            exportParticles();
+        }
+
+        if(threadStats && frame % THREAD_STATS_INTERVAL == THREAD_STATS_INTERVAL - 1) threadPool.reportUtilization();
+
         renderer.mainLoop();
 
         window.pollEvents();
+        frame++;
+    }
+}
+
+void FluidSim::replayLoop() {
+    int lastFrame = player.getFrameCount() - 1;
+    int target = 0;
+    int shown = -1;
+    int direction = 1;
+    bool playing = true;
+
+    while(!window.shouldClose()){
+        TRACE_ZONE("FluidSim::replayFrame");
+
+        //Held arrows scrub a frame per displayed frame, page keys jump a keyframe interval
+        int jump = 0;
+        if(window.consumeKeyPress(GLFW_KEY_R)) direction = -direction;
+        if(window.consumeKeyPress(GLFW_KEY_SPACE)){
+            playing = !playing;
+            //Playing from the end starts over
+            if(playing && target == (direction > 0 ? lastFrame : 0)) target = direction > 0 ? 0 : lastFrame;
+        }
+        if(window.consumeKeyPress(GLFW_KEY_PAGE_UP)) jump = player.getKeyframeInterval();
+        if(window.consumeKeyPress(GLFW_KEY_PAGE_DOWN)) jump = -player.getKeyframeInterval();
+        if(window.consumeKeyPress(GLFW_KEY_HOME)) target = 0;
+        if(window.consumeKeyPress(GLFW_KEY_END)) target = lastFrame;
+        if(window.consumeKeyPress(GLFW_KEY_M)) renderer.cycleRenderMode();
+
+        bool scrubbing = window.isKeyDown(GLFW_KEY_RIGHT) || window.isKeyDown(GLFW_KEY_LEFT);
+        if(scrubbing) playing = false;
+        target = std::clamp(target + jump, 0, lastFrame);
+        player.seek(target);
+
+        //Until the decoder catches up the last frame stays on screen
+        std::shared_ptr<const ReplayFrame> replayFrame = player.getFrame(target);
+        if(replayFrame && target != shown){
+            uploadReplayFrame(*replayFrame);
+            shown = target;
+
+            std::string title = "3D SPH Fluid Sim - " + replayFile + " frame " + std::to_string(target) + " of " +
+                                std::to_string(lastFrame + 1) + " at " + std::to_string(replayFrame->time) + " s";
+            glfwSetWindowTitle(window.getGLFWWindow(), title.c_str());
+
+            if(renderer.getRenderMode() == RENDER_MESH) extractSurface(0);
+        }
+
+        if(window.consumeKeyPress(GLFW_KEY_E)) exportSurfaces();
+
+        renderer.mainLoop();
+        window.pollEvents();
+        frame++;
+
+        //Advance only past frames that made it to the screen, so playback never skips ahead of the decoder
+        if(shown == target){
+            int step = 0;
+            if(window.isKeyDown(GLFW_KEY_RIGHT)) step = 1;
+            else if(window.isKeyDown(GLFW_KEY_LEFT)) step = -1;
+            else if(playing) step = direction;
+
+            target = std::clamp(target + step, 0, lastFrame);
+            if(playing && (target == 0 || target == lastFrame)) playing = false;
+        }
+    }
+}
+
+void FluidSim::uploadReplayFrame(const ReplayFrame& replayFrame) {
+    TRACE_ZONE("FluidSim::uploadReplayFrame");
+    //Trajectories only hold positions, everything else is drawn at rest
+    const SimParams& params = solver.getParams();
+    size_t count = replayFrame.positions.size();
+    particleCache.resize(count);
+    threadPool.parallelFor(count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            particle& p = particleCache[i];
+            p.position = glm::vec4(replayFrame.positions[i], 1.0f);
+            p.velocity = glm::vec4(0.0f, 0.0f, 0.0f, params.mass);
+            p.properties = glm::vec4(params.restDensity, 0.0f, 0.0f, 0.0f);
+        }
+    });
+    solver.writeParticles(particleCache, count);
+}
+
+void FluidSim::runHarness() {
+    //Parameter sets run back to back on the same context and programs, each against its own reference,
+    //an ensemble runs them all at once against a single reference with per scene physics samples
+    size_t runs = ensemble ? 1 : std::max<size_t>(paramSets.size(), 1);
+    std::vector<std::string> regressions;
+
+    for(size_t run = 0; run < runs; run++){
+        std::string runScene = scene;
+        std::string runFile = harnessFile;
+        std::string runReport = reportFile;
+        if(ensemble){
+            for(const std::string& file : paramFiles) runScene += " --params " + file;
+        }else if(!paramSets.empty()){
+            if(run > 0) applyParams(run);
+            runScene += (runScene.empty() ? "" : " ") + std::string("--params ") + paramFiles[run];
+        }
+        if(runs > 1){
+            runFile += "." + std::to_string(run);
+            runReport = runFile + ".report.txt";
+        }
+
+        harness.init(&solver, runScene, harnessSteps);
+        harness.run();
+
+        if(harnessMode == HARNESS_RECORD) harness.record(runFile);
+        else if(!harness.compare(runFile, runReport, performanceTolerance, physicsTolerance)) regressions.push_back(runReport);
+    }
+
+    if(!regressions.empty()){
+        std::string reports;
+        for(const std::string& report : regressions) reports += (reports.empty() ? "" : ", ") + report;
+        cleanup();
+        throw std::runtime_error("Regression against " + harnessFile + ", see " + reports);
+    }
+}
+
+void FluidSim::applyParams(size_t index) {
+    currentParams = index;
+    solver.setParams(paramSets[index]);
+    solver.reset();
+
+    const SimParams& params = solver.getParams();
+    surfaceExtractor.init(&threadPool, params.h / 4.0f, params.h, 0.5f, params.mass);
+    std::cout << "Parameters: " << paramFiles[index] << std::endl;
+}
+
+void FluidSim::extractSurface(int scene) {
+    TRACE_ZONE("FluidSim::extractSurface");
+    //Ensemble scenes overlap in the domain, a surface only ever covers one of them
+    if(ensemble) solver.readScene(scene, particleCache);
+    else solver.readParticles(particleCache);
+    if(ranks > 1) particleCache.resize(solver.getOwnedCount());
+    surfaceExtractor.extract(particleCache);
+}
+
+void FluidSim::exportSurfaces() {
+    if(!ensemble){
+        extractSurface(0);
+        surfaceExtractor.exportPLY("surface_" + std::to_string(frame) + ".ply");
+        return;
+    }
+
+    for(int scene = 0; scene < solver.getSceneCount(); scene++){
+        extractSurface(scene);
+        surfaceExtractor.exportPLY("surface_" + std::to_string(frame) + ".scene" + std::to_string(scene) + ".ply");
+    }
+    extractSurface(currentParams);
+}
+
+void FluidSim::exportParticles() {
+    TRACE_ZONE("FluidSim::exportParticles");
+    std::string basename = "particles_" + std::to_string(frame);
+    if(ranks > 1) basename += ".rank" + std::to_string(transport.getRank());
+
+    if(!ensemble){
+        solver.readParticles(particleCache);
+        if(ranks > 1) particleCache.resize(solver.getOwnedCount());
+        exporter.exportParticles(particleCache, basename);
+        return;
+    }
+
+    for(int scene = 0; scene < solver.getSceneCount(); scene++){
+        solver.readScene(scene, particleCache);
+        exporter.exportParticles(particleCache, basename + ".scene" + std::to_string(scene));
     }
 }
 
 void FluidSim::cleanup() {
+    player.cleanup();
+    trajectory.cleanup();
+    publisher.cleanup();
+    surfaceExtractor.cleanup();
+    threadPool.cleanup();
+
     renderer.cleanup();
 
     window.cleanup();
+
+    //Closing the sockets lets the other ranks notice and stop as well
+    if(ranks > 1){
+        decomposition.cleanup();
+        transport.cleanup();
+    }
+
+    //Every thread that recorded is joined or idle by now
+    if(!traceFile.empty()){
+        Trace::stop();
+        Trace::write(ranks > 1 ? traceFile + "." + std::to_string(transport.getRank()) : traceFile);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "FramePublisher.h"
+
+void FramePublisher::init(const std::string& name, int capacity, int slotCount){
+    if(slotCount < 2) throw std::runtime_error("The frame ring needs at least two slots");
+
+    this->name = name.empty() || name[0] != '/' ? "/" + name : name;
+    frame = 0;
+
+    //Slots stay 8 byte aligned for their version counters
+    size_t slotBytes = sizeof(FrameSlotHeader) + (size_t)capacity * FRAME_RING_FIELDS * sizeof(float);
+    slotBytes = (slotBytes + 7) & ~size_t(7);
+    mappedBytes = sizeof(FrameRingHeader) + slotCount * slotBytes;
+
+    int fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("Failed to create shared memory " + this->name + ": " + std::strerror(errno));
+
+    if(ftruncate(fd, mappedBytes) < 0){
+        close(fd);
+        shm_unlink(this->name.c_str());
+        throw std::runtime_error("Failed to size shared memory " + this->name + ": " + std::strerror(errno));
+    }
+
+    void* memory = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        shm_unlink(this->name.c_str());
+        throw std::runtime_error("Failed to map shared memory " + this->name + ": " + std::strerror(errno));
+    }
+
+    //Fresh memory is zeroed, so every slot starts at version 0 and no frame is complete; the magic goes in last
+    header = static_cast<FrameRingHeader*>(memory);
+    header->version = FRAME_RING_VERSION;
+    header->slotCount = slotCount;
+    header->slotCapacity = capacity;
+    header->fieldCount = FRAME_RING_FIELDS;
+    header->slotBytes = slotBytes;
+    __atomic_store_n(&header->sequence, FRAME_RING_NONE, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+
+    std::cout << "Publishing frames to shared memory " << this->name << ": " << slotCount << " slots of " << capacity
+              << " particles, " << mappedBytes / (1024 * 1024) << " MiB" << std::endl;
+}
+
+FrameSlotHeader* FramePublisher::getSlot(uint64_t frame){
+    char* slots = reinterpret_cast<char*>(header) + sizeof(FrameRingHeader);
+    return reinterpret_cast<FrameSlotHeader*>(slots + (frame % header->slotCount) * header->slotBytes);
+}
+
+void FramePublisher::publish(const std::vector<particle>& particles, float time){
+    TRACE_ZONE("FramePublisher::publish");
+    FrameSlotHeader* slot = getSlot(frame);
+    uint32_t count = std::min<size_t>(particles.size(), header->slotCapacity);
+
+    //Odd version first, so a reader that copies while the rows change sees the version move
+    __atomic_store_n(&slot->version, 2 * frame + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->frame, frame, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->particleCount, count, __ATOMIC_RELAXED);
+    slot->time = time;
+
+    float* rows = reinterpret_cast<float*>(slot + 1);
+    for(uint32_t i = 0; i < count; i++){
+        const particle& p = particles[i];
+        float* row = rows + i * FRAME_RING_FIELDS;
+        row[0] = p.position.x;
+        row[1] = p.position.y;
+        row[2] = p.position.z;
+        row[3] = p.properties.x;
+        row[4] = p.velocity.x;
+        row[5] = p.velocity.y;
+        row[6] = p.velocity.z;
+        row[7] = p.velocity.w;
+    }
+
+    __atomic_store_n(&slot->version, 2 * frame + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->sequence, frame, __ATOMIC_RELEASE);
+    frame++;
+}
+
+uint64_t FramePublisher::getFrameCount(){
+    return frame;
+}
+
+void FramePublisher::cleanup(){
+    //Readers keep their mappings, the name just goes away
+    if(header == nullptr) return;
+    munmap(header, mappedBytes);
+    shm_unlink(name.c_str());
+    header = nullptr;
+}
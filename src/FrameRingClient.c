@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "FrameRing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static FrameSlotHeader* slot_of(FrameRingHeader* header, uint64_t frame){
+    char* slots = (char*)header + sizeof(FrameRingHeader);
+    return (FrameSlotHeader*)(slots + (frame % header->slotCount) * header->slotBytes);
+}
+
+int frame_ring_open(FrameRingReader* reader, const char* name){
+    //Same naming as FramePublisher, a leading slash is added when missing
+    char path[256];
+    if(snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name) >= (int)sizeof(path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if(fd < 0) return -1;
+
+    struct stat info;
+    if(fstat(fd, &info) < 0){
+        close(fd);
+        return -1;
+    }
+    if((size_t)info.st_size < sizeof(FrameRingHeader)){
+        close(fd);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    void* memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED) return -1;
+
+    //The producer stores the magic last, anything else means it is still setting up or speaks another layout
+    FrameRingHeader* header = (FrameRingHeader*)memory;
+    uint32_t magic = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE);
+    int valid = magic == FRAME_RING_MAGIC && header->version == FRAME_RING_VERSION && header->slotCount >= 2 &&
+                sizeof(FrameRingHeader) + header->slotCount * header->slotBytes <= (size_t)info.st_size;
+    if(!valid){
+        munmap(memory, info.st_size);
+        errno = magic == 0 ? EAGAIN : EPROTO;
+        return -1;
+    }
+
+    //Readers join at the latest frame, history before that is not theirs
+    uint64_t latest = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    reader->header = header;
+    reader->mappedBytes = info.st_size;
+    reader->next = latest == FRAME_RING_NONE ? 0 : latest;
+    reader->skipped = 0;
+    return 0;
+}
+
+void frame_ring_close(FrameRingReader* reader){
+    if(reader->header != NULL) munmap(reader->header, reader->mappedBytes);
+    reader->header = NULL;
+}
+
+//Copies frame out of its slot, fails if the slot holds another frame or the producer came by during the copy
+static int copy_frame(FrameRingHeader* header, uint64_t frame, Frame* out){
+    FrameSlotHeader* slot = slot_of(header, frame);
+    uint64_t complete = 2 * frame + 2;
+    if(__atomic_load_n(&slot->version, __ATOMIC_ACQUIRE) != complete) return 0;
+
+    uint32_t count = __atomic_load_n(&slot->particleCount, __ATOMIC_RELAXED);
+    if(count > header->slotCapacity) count = header->slotCapacity;
+    out->frame = __atomic_load_n(&slot->frame, __ATOMIC_RELAXED);
+    out->particleCount = count;
+    out->time = slot->time;
+    memcpy(out->data, slot + 1, (size_t)count * header->fieldCount * sizeof(float));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->version, __ATOMIC_RELAXED) == complete;
+}
+
+int frame_ring_read(FrameRingReader* reader, Frame* out){
+    FrameRingHeader* header = reader->header;
+
+    for(;;){
+        uint64_t latest = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if(latest == FRAME_RING_NONE || reader->next > latest) return 0;
+
+        //Frames older than the ring were overwritten, a slow reader skips ahead instead of holding the producer up
+        uint64_t oldest = latest >= header->slotCount - 1 ? latest - (header->slotCount - 1) : 0;
+        if(reader->next < oldest){
+            reader->skipped += oldest - reader->next;
+            reader->next = oldest;
+        }
+
+        uint64_t frame = reader->next++;
+        if(copy_frame(header, frame, out)) return 1;
+        reader->skipped++;
+    }
+}
+
+int frame_ring_read_latest(FrameRingReader* reader, Frame* out){
+    uint64_t latest = __atomic_load_n(&reader->header->sequence, __ATOMIC_ACQUIRE);
+    if(latest != FRAME_RING_NONE && latest > reader->next){
+        reader->skipped += latest - reader->next;
+        reader->next = latest;
+    }
+    return frame_ring_read(reader, out);
+}
@@ -0,0 +1,86 @@
+#include "GpuTimer.h"
+
+void GpuTimer::init(unsigned int latency, const char* traceName){
+    this->traceName = traceName;
+    spans.resize(latency);
+    for(Span& span : spans){
+        glGenQueries(1, &span.query);
+        glGenQueries(1, &span.startQuery);
+        span.pending = false;
+        span.traced = false;
+    }
+}
+
+void GpuTimer::cleanup(){
+    for(Span& span : spans){
+        glDeleteQueries(1, &span.query);
+        glDeleteQueries(1, &span.startQuery);
+    }
+    spans.clear();
+}
+
+void GpuTimer::calibrateTraceClock(){
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    Trace::setGpuClockOffset(Trace::now() - gpuTime);
+}
+
+void GpuTimer::begin(){
+    collect();
+
+    //Skip this span rather than wait if the ring is still full of unfinished queries
+    if(spans[next].pending) return;
+
+    //Elapsed time queries carry no position on the timeline, a timestamp at the start places the span
+    spans[next].traced = traceName && Trace::isEnabled();
+    if(spans[next].traced) glQueryCounter(spans[next].startQuery, GL_TIMESTAMP);
+
+    glBeginQuery(GL_TIME_ELAPSED, spans[next].query);
+    open = true;
+}
+
+void GpuTimer::end(unsigned int weight){
+    if(!open) return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    spans[next].weight = weight;
+    spans[next].pending = true;
+    next = (next + 1) % spans.size();
+    open = false;
+}
+
+void GpuTimer::collect(){
+    for(Span& span : spans){
+        if(!span.pending) continue;
+
+        GLuint available = 0;
+        glGetQueryObjectuiv(span.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) continue;
+
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(span.query, GL_QUERY_RESULT, &elapsed);
+        totalMs += elapsed / 1.0e6;
+
+        if(span.traced){
+            GLuint64 start;
+            glGetQueryObjectui64v(span.startQuery, GL_QUERY_RESULT, &start);
+            Trace::recordGpu(traceName, start, start + elapsed);
+        }
+        totalWeight += span.weight;
+        span.pending = false;
+    }
+}
+
+double GpuTimer::getAverage(){
+    collect();
+    return totalWeight > 0 ? totalMs / totalWeight : 0.0;
+}
+
+unsigned int GpuTimer::getSampleWeight(){
+    return totalWeight;
+}
+
+void GpuTimer::reset(){
+    totalMs = 0.0;
+    totalWeight = 0;
+}
@@ -0,0 +1,328 @@
+#include "ParticleExporter.h"
+
+const ParticleExporter::Attribute ParticleExporter::attributeTable[5] = {
+    {EXPORT_POSITION, "position", 3, "x y z"},
+    {EXPORT_VELOCITY, "velocity", 3, "vx vy vz"},
+    {EXPORT_DENSITY, "density", 1, "density"},
+    {EXPORT_PRESSURE, "pressure", 1, "pressure"},
+    {EXPORT_MASS, "mass", 1, "mass"}
+};
+
+void ParticleExporter::init(ThreadPool* threadPool, ExportFormat format, unsigned int attributes){
+    this->threadPool = threadPool;
+    this->format = format;
+    this->attributes = attributes;
+
+    //Every format but the raw columns needs the points themselves
+    if(format != EXPORT_RAW) this->attributes |= EXPORT_POSITION;
+
+    if(this->attributes == 0){
+        throw std::runtime_error("No attributes selected for export!");
+    }
+}
+
+ExportFormat ParticleExporter::parseFormat(const std::string& name){
+    if(name == "vtu") return EXPORT_VTU;
+    if(name == "vtk") return EXPORT_VTK;
+    if(name == "ply") return EXPORT_PLY;
+    if(name == "raw") return EXPORT_RAW;
+    throw std::runtime_error("Unknown export format " + name + ", expected vtu, vtk, ply or raw!");
+}
+
+unsigned int ParticleExporter::parseAttributes(const std::string& list){
+    unsigned int attributes = 0;
+    std::stringstream stream(list);
+    std::string name;
+    while(std::getline(stream, name, ',')){
+        bool found = false;
+        for(const Attribute& attribute : attributeTable){
+            if(name == attribute.name){
+                attributes |= attribute.flag;
+                found = true;
+            }
+        }
+        if(!found){
+            throw std::runtime_error("Unknown export attribute " + name + "!");
+        }
+    }
+    return attributes;
+}
+
+std::vector<ParticleExporter::Attribute> ParticleExporter::getAttributes(){
+    std::vector<Attribute> selected;
+    for(const Attribute& attribute : attributeTable){
+        if(attributes & attribute.flag) selected.push_back(attribute);
+    }
+    return selected;
+}
+
+void ParticleExporter::readAttribute(const particle& p, ExportAttribute attribute, float* out){
+    switch(attribute){
+        case EXPORT_POSITION: out[0] = p.position.x; out[1] = p.position.y; out[2] = p.position.z; break;
+        case EXPORT_VELOCITY: out[0] = p.velocity.x; out[1] = p.velocity.y; out[2] = p.velocity.z; break;
+        case EXPORT_DENSITY: out[0] = p.properties.x; break;
+        case EXPORT_PRESSURE: out[0] = p.properties.y; break;
+        case EXPORT_MASS: out[0] = p.velocity.w; break;
+    }
+}
+
+std::string ParticleExporter::exportParticles(const std::vector<particle>& particles, const std::string& basename){
+    TRACE_ZONE("ParticleExporter::exportParticles");
+    auto start = std::chrono::high_resolution_clock::now();
+    bytesWritten = 0;
+
+    std::string filename;
+    switch(format){
+        case EXPORT_VTU: filename = basename + ".vtu"; exportVTU(particles, filename); break;
+        case EXPORT_VTK: filename = basename + ".vtk"; exportVTK(particles, filename); break;
+        case EXPORT_PLY: filename = basename + ".ply"; exportPLY(particles, filename); break;
+        case EXPORT_RAW: filename = basename + ".txt"; exportRaw(particles, basename); break;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    double megabytes = bytesWritten / (1024.0 * 1024.0);
+    std::cout << "Exported " << particles.size() << " particles to " << filename << ": " << megabytes << " MB in "
+              << 1000.0 * seconds << " ms, " << megabytes / std::max(seconds, 1.0e-9) << " MB/s" << std::endl;
+
+    return filename;
+}
+
+void ParticleExporter::writeSection(std::ofstream& file, size_t count, size_t stride, const std::function<void(size_t, size_t, char*)>& fill){
+    std::future<void> pending;
+    int current = 0;
+
+    for(size_t first = 0; first < count; first += batchSize){
+        size_t batch = std::min(batchSize, count - first);
+        std::vector<char>& buffer = buffers[current];
+        if(buffer.size() < batch * stride) buffer.resize(batch * stride);
+
+        threadPool->parallelFor(batch, [&](size_t begin, size_t end){
+            fill(first + begin, first + end, buffer.data() + begin * stride);
+        });
+
+        //The previous batch has to be out before this one is queued behind it
+        if(pending.valid()) pending.get();
+        pending = std::async(std::launch::async, [&file, &buffer, batch, stride](){
+            file.write(buffer.data(), batch * stride);
+        });
+        current ^= 1;
+    }
+    if(pending.valid()) pending.get();
+
+    if(!file){
+        throw std::runtime_error("Failed to write export!");
+    }
+    bytesWritten += count * stride;
+}
+
+void ParticleExporter::writeText(std::ofstream& file, const std::string& text){
+    file.write(text.data(), text.size());
+    bytesWritten += text.size();
+}
+
+void ParticleExporter::writeColumn(std::ofstream& file, const std::vector<particle>& particles, const Attribute& attribute, bool bigEndian){
+    size_t stride = attribute.components * sizeof(float);
+    writeSection(file, particles.size(), stride, [&](size_t begin, size_t end, char* out){
+        for(size_t i = begin; i < end; i++){
+            float values[3];
+            readAttribute(particles[i], attribute.flag, values);
+
+            uint32_t words[3];
+            std::memcpy(words, values, sizeof(words));
+            if(bigEndian){
+                for(int c = 0; c < attribute.components; c++) words[c] = __builtin_bswap32(words[c]);
+            }
+            std::memcpy(out, words, stride);
+            out += stride;
+        }
+    });
+}
+
+void ParticleExporter::exportVTU(const std::vector<particle>& particles, const std::string& filename){
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    //Appended blocks are a UInt64 byte count followed by the data, all particles form a single poly vertex cell
+    size_t count = particles.size();
+    std::vector<Attribute> selected = getAttributes();
+    uint64_t offset = 0;
+
+    auto dataArray = [&](const char* type, const char* name, int components, uint64_t bytes){
+        std::stringstream element;
+        element << "<DataArray type=\"" << type << "\"";
+        if(name) element << " Name=\"" << name << "\"";
+        element << " NumberOfComponents=\"" << components << "\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+        offset += sizeof(uint64_t) + bytes;
+        return element.str();
+    };
+
+    std::stringstream header;
+    header << "<?xml version=\"1.0\"?>\n"
+           << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+           << "<UnstructuredGrid>\n"
+           << "<Piece NumberOfPoints=\"" << count << "\" NumberOfCells=\"1\">\n"
+           << "<Points>\n" << dataArray("Float32", nullptr, 3, count * 3 * sizeof(float)) << "</Points>\n"
+           << "<PointData>\n";
+    for(const Attribute& attribute : selected){
+        if(attribute.flag == EXPORT_POSITION) continue;
+        header << dataArray("Float32", attribute.name, attribute.components, count * attribute.components * sizeof(float));
+    }
+    header << "</PointData>\n"
+           << "<Cells>\n"
+           << dataArray("Int32", "connectivity", 1, count * sizeof(int32_t))
+           << dataArray("Int32", "offsets", 1, sizeof(int32_t))
+           << dataArray("UInt8", "types", 1, sizeof(uint8_t))
+           << "</Cells>\n"
+           << "</Piece>\n"
+           << "</UnstructuredGrid>\n"
+           << "<AppendedData encoding=\"raw\">\n_";
+    writeText(file, header.str());
+
+    auto blockSize = [&](uint64_t bytes){
+        writeText(file, std::string(reinterpret_cast<const char*>(&bytes), sizeof(bytes)));
+    };
+
+    blockSize(count * 3 * sizeof(float));
+    writeColumn(file, particles, attributeTable[0], false);
+    for(const Attribute& attribute : selected){
+        if(attribute.flag == EXPORT_POSITION) continue;
+        blockSize(count * attribute.components * sizeof(float));
+        writeColumn(file, particles, attribute, false);
+    }
+
+    blockSize(count * sizeof(int32_t));
+    writeSection(file, count, sizeof(int32_t), [](size_t begin, size_t end, char* out){
+        for(size_t i = begin; i < end; i++, out += sizeof(int32_t)){
+            int32_t index = (int32_t)i;
+            std::memcpy(out, &index, sizeof(index));
+        }
+    });
+
+    int32_t cellOffset = (int32_t)count;
+    uint8_t cellType = 2; //VTK_POLY_VERTEX
+    blockSize(sizeof(cellOffset));
+    writeText(file, std::string(reinterpret_cast<const char*>(&cellOffset), sizeof(cellOffset)));
+    blockSize(sizeof(cellType));
+    writeText(file, std::string(reinterpret_cast<const char*>(&cellType), sizeof(cellType)));
+
+    writeText(file, "\n</AppendedData>\n</VTKFile>\n");
+    file.close();
+}
+
+void ParticleExporter::exportVTK(const std::vector<particle>& particles, const std::string& filename){
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    //Legacy binary VTK is big endian throughout
+    size_t count = particles.size();
+    std::stringstream header;
+    header << "# vtk DataFile Version 3.0\n"
+           << "SPH particles\n"
+           << "BINARY\n"
+           << "DATASET POLYDATA\n"
+           << "POINTS " << count << " float\n";
+    writeText(file, header.str());
+    writeColumn(file, particles, attributeTable[0], true);
+
+    std::stringstream vertices;
+    vertices << "\nVERTICES 1 " << count + 1 << "\n";
+    writeText(file, vertices.str());
+    uint32_t vertexCount = __builtin_bswap32((uint32_t)count);
+    writeText(file, std::string(reinterpret_cast<const char*>(&vertexCount), sizeof(vertexCount)));
+    writeSection(file, count, sizeof(uint32_t), [](size_t begin, size_t end, char* out){
+        for(size_t i = begin; i < end; i++, out += sizeof(uint32_t)){
+            uint32_t index = __builtin_bswap32((uint32_t)i);
+            std::memcpy(out, &index, sizeof(index));
+        }
+    });
+
+    std::stringstream pointData;
+    pointData << "\nPOINT_DATA " << count << "\n";
+    writeText(file, pointData.str());
+
+    for(const Attribute& attribute : getAttributes()){
+        if(attribute.flag == EXPORT_POSITION) continue;
+
+        if(attribute.components == 3){
+            writeText(file, std::string("VECTORS ") + attribute.name + " float\n");
+        }else{
+            writeText(file, std::string("SCALARS ") + attribute.name + " float 1\nLOOKUP_TABLE default\n");
+        }
+        writeColumn(file, particles, attribute, true);
+        writeText(file, "\n");
+    }
+
+    file.close();
+}
+
+void ParticleExporter::exportPLY(const std::vector<particle>& particles, const std::string& filename){
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    std::vector<Attribute> selected = getAttributes();
+    size_t stride = 0;
+
+    std::stringstream header;
+    header << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "element vertex " << particles.size() << "\n";
+    for(const Attribute& attribute : selected){
+        std::stringstream names(attribute.plyProperties);
+        std::string name;
+        while(names >> name) header << "property float " << name << "\n";
+        stride += attribute.components * sizeof(float);
+    }
+    header << "end_header\n";
+    writeText(file, header.str());
+
+    //Vertices are interleaved, so the whole record is formatted at once
+    writeSection(file, particles.size(), stride, [&](size_t begin, size_t end, char* out){
+        for(size_t i = begin; i < end; i++){
+            for(const Attribute& attribute : selected){
+                float values[3];
+                readAttribute(particles[i], attribute.flag, values);
+                std::memcpy(out, values, attribute.components * sizeof(float));
+                out += attribute.components * sizeof(float);
+            }
+        }
+    });
+
+    file.close();
+}
+
+void ParticleExporter::exportRaw(const std::vector<particle>& particles, const std::string& basename){
+    std::ofstream description(basename + ".txt");
+
+    if(!description.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    //Strip the directory, the columns are found next to the description
+    std::string name = basename.substr(basename.find_last_of('/') + 1);
+
+    description << "particles " << particles.size() << "\n";
+    for(const Attribute& attribute : getAttributes()){
+        std::string column = basename + "." + attribute.name + ".f32";
+        std::ofstream file(column, std::ios::binary);
+
+        if(!file.is_open()){
+            throw std::runtime_error("Failed to open file!");
+        }
+
+        writeColumn(file, particles, attribute, false);
+        file.close();
+
+        description << attribute.name << " float32 " << attribute.components << " " << name << "." << attribute.name << ".f32\n";
+    }
+
+    description.close();
+}
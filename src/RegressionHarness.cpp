@@ -0,0 +1,217 @@
+#include "RegressionHarness.h"
+
+void RegressionHarness::init(SPH* solver, const std::string& scene, int steps){
+    this->solver = solver;
+    this->scene = scene;
+    this->steps = steps;
+
+    if(steps < sampleInterval) throw std::runtime_error("The regression harness needs at least " + std::to_string(sampleInterval) + " steps");
+
+    solver->setStageTiming(true);
+}
+
+void RegressionHarness::run(){
+    metrics.clear();
+
+    //The first interval warms up caches and drivers and is left out of the timings
+    solver->advance(sampleInterval);
+    sample(sampleInterval);
+    solver->resetStageTimes();
+    glFinish();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int timedSteps = 0;
+    std::chrono::duration<double> sampling(0.0);
+
+    for(int step = sampleInterval; step < steps;){
+        int count = std::min(sampleInterval, steps - step);
+        solver->advance(count);
+        step += count;
+        timedSteps += count;
+
+        //Read backs stall the pipeline, keep them out of the throughput
+        glFinish();
+        auto sampleStart = std::chrono::high_resolution_clock::now();
+        sample(step);
+        sampling += std::chrono::high_resolution_clock::now() - sampleStart;
+    }
+
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start - sampling).count();
+
+    addMetric("steps_per_second", timedSteps / seconds, HIGHER_IS_BETTER);
+
+    //Ensembles step every scene at once, what a sweep gains is the scenes advanced per second
+    int scenes = solver->getSceneCount();
+    if(scenes > 1) addMetric("scene_steps_per_second", scenes * timedSteps / seconds, HIGHER_IS_BETTER);
+
+    std::vector<double> stageTimes = solver->getStageTimes();
+    for(int stage = 0; stage < STAGE_COUNT; stage++){
+        if(stageTimes[stage] > 0.0) addMetric(std::string("stage_ms.") + SPH::stageNames[stage], stageTimes[stage] / timedSteps, LOWER_IS_BETTER);
+    }
+
+    std::cout << "Regression run: " << steps << " steps of " << (scene.empty() ? "the default scene" : scene) << ", "
+              << timedSteps / seconds << " steps per second";
+    if(scenes > 1) std::cout << " for " << scenes << " scenes (" << scenes * timedSteps / seconds << " scene steps per second)";
+    std::cout << std::endl;
+}
+
+void RegressionHarness::sample(int step){
+    //Every ensemble scene is sampled on its own, against its own rest density and gravity
+    std::string prefix = "step_" + std::to_string(step) + ".";
+    int scenes = solver->getSceneCount();
+
+    for(int scene = 0; scene < scenes; scene++){
+        solver->readScene(scene, particles);
+        samplePhysics(scenes > 1 ? "scene_" + std::to_string(scene) + "." + prefix : prefix, solver->getSceneParams(scene));
+    }
+}
+
+void RegressionHarness::samplePhysics(const std::string& prefix, const SimParams& params){
+    double restDensity = params.restDensity;
+    double densityError = 0.0, maxDensityError = 0.0;
+    double kinetic = 0.0, potential = 0.0;
+    glm::dvec3 gravity = glm::dvec3(params.gravity);
+    glm::dvec3 sum(0.0), sumSquares(0.0);
+    double minHeight = SPH::domainMax, maxHeight = SPH::domainMin;
+
+    for(const particle& p : particles){
+        double mass = p.velocity.w;
+        glm::dvec3 position = glm::dvec3(glm::vec3(p.position));
+        glm::dvec3 velocity = glm::dvec3(glm::vec3(p.velocity));
+
+        double error = std::abs(p.properties.x - restDensity) / restDensity;
+        densityError += error;
+        maxDensityError = std::max(maxDensityError, error);
+
+        kinetic += 0.5 * mass * glm::dot(velocity, velocity);
+        potential += mass * -glm::dot(gravity, position - glm::dvec3(SPH::domainMin));
+
+        sum += position;
+        sumSquares += position * position;
+        minHeight = std::min(minHeight, position.y);
+        maxHeight = std::max(maxHeight, position.y);
+    }
+
+    //Scales: positions matter at a tenth of a smoothing length, density errors at a percent of the rest density
+    double count = std::max<size_t>(particles.size(), 1);
+    glm::dvec3 mean = sum / count;
+    glm::dvec3 spread = glm::sqrt(glm::max(sumSquares / count - mean * mean, glm::dvec3(0.0)));
+    double positionScale = 0.1 * params.h;
+
+    addMetric(prefix + "particles", particles.size(), PHYSICS, 1.0);
+    addMetric(prefix + "density_error_mean", densityError / count, PHYSICS, 0.01);
+    addMetric(prefix + "density_error_max", maxDensityError, PHYSICS, 0.01);
+    addMetric(prefix + "kinetic_energy", kinetic, PHYSICS, 1.0);
+    addMetric(prefix + "potential_energy", potential, PHYSICS, 1.0);
+    addMetric(prefix + "centroid_x", mean.x, PHYSICS, positionScale);
+    addMetric(prefix + "centroid_y", mean.y, PHYSICS, positionScale);
+    addMetric(prefix + "centroid_z", mean.z, PHYSICS, positionScale);
+    addMetric(prefix + "spread_x", spread.x, PHYSICS, positionScale);
+    addMetric(prefix + "spread_y", spread.y, PHYSICS, positionScale);
+    addMetric(prefix + "spread_z", spread.z, PHYSICS, positionScale);
+    addMetric(prefix + "height_min", particles.empty() ? 0.0 : minHeight, PHYSICS, positionScale);
+    addMetric(prefix + "height_max", particles.empty() ? 0.0 : maxHeight, PHYSICS, positionScale);
+}
+
+void RegressionHarness::addMetric(const std::string& name, double value, MetricKind kind, double scale){
+    metrics.push_back({name, value, kind, scale});
+}
+
+void RegressionHarness::record(const std::string& filename){
+    std::ofstream file(filename);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open " + filename);
+    }
+
+    //One "name value" pair per line, full precision so deterministic runs compare exactly
+    file << "scene " << scene << "\n"
+         << "steps " << steps << "\n";
+    file << std::setprecision(17);
+    for(const Metric& metric : metrics){
+        file << metric.name << " " << metric.value << "\n";
+    }
+
+    std::cout << "Recorded " << metrics.size() << " metrics to " << filename << std::endl;
+}
+
+bool RegressionHarness::compare(const std::string& filename, const std::string& reportFile, double performanceTolerance, double physicsTolerance){
+    std::ifstream file(filename);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open reference " + filename);
+    }
+
+    std::string referenceScene;
+    int referenceSteps = 0;
+    std::map<std::string, double> reference;
+
+    std::string line;
+    while(std::getline(file, line)){
+        size_t space = line.find(' ');
+        std::string name = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+
+        if(name == "scene") referenceScene = value;
+        else if(name == "steps") referenceSteps = std::stoi(value);
+        else if(!name.empty()) reference[name] = std::stod(value);
+    }
+
+    if(referenceScene != scene || referenceSteps != steps){
+        throw std::runtime_error("Reference " + filename + " was recorded for '" + referenceScene + "' over " + std::to_string(referenceSteps) +
+                                 " steps, this run is '" + scene + "' over " + std::to_string(steps) + " steps");
+    }
+
+    std::ofstream report(reportFile);
+    if(!report.is_open()){
+        throw std::runtime_error("Failed to open " + reportFile);
+    }
+
+    report << "Regression report against " << filename << "\n"
+           << "scene: " << (scene.empty() ? "default" : scene) << ", " << steps << " steps\n"
+           << "tolerances: performance " << 100.0 * performanceTolerance << "%, physics " << 100.0 * physicsTolerance << "% of scale\n\n"
+           << std::left << std::setw(36) << "metric" << std::setw(16) << "reference" << std::setw(16) << "current" << std::setw(12) << "change" << "status\n";
+
+    int failures = 0;
+    for(const Metric& metric : metrics){
+        auto found = reference.find(metric.name);
+        if(found == reference.end()){
+            report << std::setw(36) << metric.name << std::setw(16) << "-" << std::setw(16) << metric.value << std::setw(12) << "-" << "new\n";
+            continue;
+        }
+
+        double expected = found->second;
+        reference.erase(found);
+
+        //Performance only fails when it gets worse, physics fails on drift in either direction
+        double change;
+        bool failed;
+        if(metric.kind == PHYSICS){
+            change = (metric.value - expected) / std::max(std::abs(expected), metric.scale);
+            failed = !(std::abs(change) <= physicsTolerance);
+        }else{
+            change = expected != 0.0 ? (metric.value - expected) / std::abs(expected) : 0.0;
+            double loss = metric.kind == HIGHER_IS_BETTER ? -change : change;
+            failed = !(loss <= performanceTolerance);
+        }
+
+        std::ostringstream changeText;
+        changeText << std::showpos << std::fixed << std::setprecision(2) << 100.0 * change << "%";
+
+        report << std::setw(36) << metric.name << std::setw(16) << expected << std::setw(16) << metric.value << std::setw(12) << changeText.str()
+               << (failed ? "REGRESSION" : "ok") << "\n";
+        if(failed) failures++;
+    }
+
+    //Whatever the reference has that this run did not produce counts as a regression, a stage or sample went missing
+    for(const auto& missing : reference){
+        report << std::setw(36) << missing.first << std::setw(16) << missing.second << std::setw(16) << "-" << std::setw(12) << "-" << "REGRESSION (missing)\n";
+        failures++;
+    }
+
+    report << "\n" << failures << " regression" << (failures == 1 ? "" : "s") << "\n";
+
+    std::cout << "Compared " << metrics.size() << " metrics against " << filename << ": " << failures << " regression"
+              << (failures == 1 ? "" : "s") << ", report written to " << reportFile << std::endl;
+
+    return failures == 0;
+}
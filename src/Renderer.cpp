@@ -1,6 +1,9 @@
 #include "Renderer.h"
 
+#include "MarchingCubesTables.h"
+
 void Renderer::init(GLFWwindow* window, SPH* solver) {
+    TRACE_ZONE("Renderer::init");
     _window = window;
     _solver = solver;
 
@@ -12,22 +15,47 @@ void Renderer::init(GLFWwindow* window, SPH* solver) {
 
     configureBuffers();
     compileAndLoadShaders();
+    renderTimer.init(4, "render");
 
     viewMatrix = glm::mat4(1.0f);
     viewMatrixLocation = glGetUniformLocation(pointsProgram, "viewMatrix");
+    meshViewMatrixLocation = glGetUniformLocation(meshProgram, "viewMatrix");
+    positionScaleLocation = glGetUniformLocation(pointsProgram, "positionScale");
+    positionBiasLocation = glGetUniformLocation(pointsProgram, "positionBias");
+
+    modelMatrix = glm::mat4(1.0, 0.0, 0.0, 0.0,
+                            0.0, 1.0, 0.0, 0.0,
+                            0.0, 0.0, 1.0, 0.0,
+                            0.0, 0.0, -1.5, 1.0);
+    projectionMatrix = glm::mat4(0.5, 0.0, 0.0, 0.0,
+                                 0.0, 0.5, 0.0, 0.0,
+                                 0.0, 0.0, -0.5, -1.0,
+                                 0.0, 0.0, 0.0, 1.0);
+
+    mvpMatrixLocation = glGetUniformLocation(cullProgram, "mvpMatrix");
+    frustumPlanesLocation = glGetUniformLocation(cullProgram, "frustumPlanes");
+    particleRadiusLocation = glGetUniformLocation(cullProgram, "particleRadius");
+    projectionScaleLocation = glGetUniformLocation(cullProgram, "projectionScale");
+    viewportHeightLocation = glGetUniformLocation(cullProgram, "viewportHeight");
+    minPixelSizeLocation = glGetUniformLocation(cullProgram, "minPixelSize");
+    decimationStrideLocation = glGetUniformLocation(cullProgram, "decimationStride");
+    ownedCountLocation = glGetUniformLocation(cullProgram, "ownedCount");
 }
 
 void Renderer::mainLoop() {
+    TRACE_ZONE("Renderer::mainLoop");
+    if(Trace::isEnabled()) renderTimer.begin();
+
+    if(cullParticles) cullAndCompactParticles();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     switch(renderMode){
         case RENDER_POINTS:
-            glBindVertexArray(VAO);
             glPointSize(5.0f);
             glUseProgram(pointsProgram);
             glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-            glDrawArrays(GL_POINTS, 0, _solver->getParticleCount());
-            glBindVertexArray(0);
+            drawParticles();
 
             break;
         case RENDER_SSFR:
@@ -40,9 +68,7 @@ void Renderer::mainLoop() {
             glPointSize(5.0f);
             glUseProgram(pointsProgram);
             glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_POINTS, 0, _solver->getParticleCount());
-            glBindVertexArray(0);
+            drawParticles();
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -58,21 +84,255 @@ void Renderer::mainLoop() {
             glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
             glBindVertexArray(0);
 
+            break;
+        case RENDER_MESH:
+            uploadSurfaceMesh();
+
+            glEnable(GL_DEPTH_TEST);
+
+            glUseProgram(meshProgram);
+            glUniformMatrix4fv(meshViewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+            glBindVertexArray(meshVAO);
+            glDrawArrays(GL_TRIANGLES, 0, meshVertexCount);
+            glBindVertexArray(0);
+
+            break;
+        case RENDER_MESH_GPU:
+            extractSurfaceOnGPU();
+
+            glEnable(GL_DEPTH_TEST);
+
+            glUseProgram(meshProgram);
+            glUniformMatrix4fv(meshViewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+            glBindVertexArray(gpuMeshVAO);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mcDrawBuffer);
+            glDrawArraysIndirect(GL_TRIANGLES, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            glBindVertexArray(0);
+
             break;
         default:
             break;
     }
 
-    glfwSwapBuffers(_window);
+    renderTimer.end();
+
+    {
+        //Waits for vsync
+        TRACE_ZONE("Renderer::swapBuffers");
+        glfwSwapBuffers(_window);
+    }
 }
 
 void Renderer::cleanup() {
+    renderTimer.cleanup();
     glDeleteFramebuffers(1, &framebuffer);
     glDeleteBuffers(1, &quadVBO);
     glDeleteBuffers(1, &quadEBO);
+    glDeleteBuffers(1, &culledSSBO);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteBuffers(1, &meshVBO);
+    glDeleteBuffers(1, &mcTableBuffer);
+    glDeleteBuffers(1, &mcCubeIndexBuffer);
+    glDeleteBuffers(1, &mcActiveCellBuffer);
+    glDeleteBuffers(1, &mcVertexBuffer);
+    glDeleteBuffers(1, &mcDispatchBuffer);
+    glDeleteBuffers(1, &mcDrawBuffer);
+    glDeleteBuffers(1, &scanInputBuffer);
+    glDeleteBuffers(1, &scanOutputBuffer);
+    glDeleteBuffers(1, &scanBlockSumBuffer);
+    glDeleteTextures(1, &mcDensityTexture);
     glDeleteVertexArrays(1, &VAO);
+    glDeleteVertexArrays(1, &culledVAO);
     glDeleteVertexArrays(1, &quadVAO);
+    glDeleteVertexArrays(1, &meshVAO);
+    glDeleteVertexArrays(1, &gpuMeshVAO);
     glDeleteProgram(pointsProgram);
+    glDeleteProgram(cullProgram);
+    glDeleteProgram(meshProgram);
+    glDeleteProgram(mcSplatProgram);
+    glDeleteProgram(mcClassifyProgram);
+    glDeleteProgram(mcCompactProgram);
+    glDeleteProgram(mcGenerateProgram);
+    glDeleteProgram(scanProgram);
+}
+
+void Renderer::setSurfaceMesh(const SurfaceMesh* mesh) {
+    _surfaceMesh = mesh;
+}
+
+void Renderer::setSurfaceScene(int scene) {
+    surfaceScene = scene;
+}
+
+void Renderer::cycleRenderMode() {
+    renderMode = (renderMode + 1) % RENDER_MODE_COUNT;
+}
+
+int Renderer::getRenderMode() {
+    return renderMode;
+}
+
+void Renderer::uploadSurfaceMesh() {
+    TRACE_ZONE("Renderer::uploadSurfaceMesh");
+    if(_surfaceMesh == nullptr || _surfaceMesh->version == uploadedMeshVersion) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glBufferData(GL_ARRAY_BUFFER, _surfaceMesh->vertices.size() * sizeof(MeshVertex), _surfaceMesh->vertices.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    meshVertexCount = (GLsizei)_surfaceMesh->vertices.size();
+    uploadedMeshVersion = _surfaceMesh->version;
+}
+
+void Renderer::cullAndCompactParticles() {
+    TRACE_ZONE("Renderer::cullAndCompactParticles");
+    glm::mat4 mvp = projectionMatrix * viewMatrix * modelMatrix;
+
+    //Extract the six frustum planes from the combined matrix (left, right, bottom, top, near, far)
+    glm::vec4 planes[6];
+    for(int i = 0; i < 3; i++){
+        glm::vec4 row = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+        glm::vec4 rowW = glm::vec4(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+        planes[2 * i] = rowW + row;
+        planes[2 * i + 1] = rowW - row;
+    }
+    for(glm::vec4& plane : planes){
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    //Reset the draw count, the cull pass appends every visible particle to it
+    DrawArraysIndirectCommand command = {0, 1, 0, 0};
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _solver->getBufferId());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indirectBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culledSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, _solver->getStateBufferId());
+
+    glUseProgram(cullProgram);
+    glUniformMatrix4fv(mvpMatrixLocation, 1, GL_FALSE, glm::value_ptr(mvp));
+    glUniform4fv(frustumPlanesLocation, 6, glm::value_ptr(planes[0]));
+    glUniform1f(particleRadiusLocation, particleRadius);
+    glUniform1f(projectionScaleLocation, projectionMatrix[1][1]);
+    glUniform1f(viewportHeightLocation, (float)_height);
+    glUniform1f(minPixelSizeLocation, minPixelSize);
+    glUniform1ui(decimationStrideLocation, decimationStride);
+    glUniform1ui(ownedCountLocation, _solver->getOwnedCount());
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, _solver->getStateBufferId());
+    glDispatchComputeIndirect(SPH::particleDispatchOffset);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Renderer::drawParticles() {
+    bool packed = !cullParticles && _solver->isCompactStorage();
+    float positionScale = packed ? SPH::domainMax - SPH::domainMin : 1.0f;
+    float positionBias = packed ? SPH::domainMin : 0.0f;
+    glUniform3f(positionScaleLocation, positionScale, positionScale, positionScale);
+    glUniform3f(positionBiasLocation, positionBias, positionBias, positionBias);
+
+    if(cullParticles){
+        glBindVertexArray(culledVAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glDrawArraysIndirect(GL_POINTS, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }else{
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _solver->getStateBufferId());
+        glDrawArraysIndirect(GL_POINTS, (void*)SPH::particleDrawOffset);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    glBindVertexArray(0);
+}
+
+void Renderer::extractSurfaceOnGPU() {
+    TRACE_ZONE("Renderer::extractSurfaceOnGPU");
+    int cells = mcResolution - 1;
+    GLuint cellCount = cells * cells * cells;
+    float gridPadding = _solver->getParams().h;
+    float gridSpacing = (2.0f + 2.0f * gridPadding) / cells;
+    glm::vec3 gridOrigin = glm::vec3(-1.0f - gridPadding);
+
+    GLuint zero = 0;
+    glClearTexImage(mcDensityTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    DrawArraysIndirectCommand command = {0, 1, 0, 0};
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mcDrawBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindImageTexture(0, mcDensityTexture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _solver->getBufferId());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, scanInputBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, scanOutputBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, scanBlockSumBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, mcTableBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, mcCubeIndexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, mcActiveCellBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, mcVertexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, mcDispatchBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, mcDrawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, _solver->getStateBufferId());
+
+    //Splat particle densities into the fixed point density texture
+    glUseProgram(mcSplatProgram);
+    glUniform1f(glGetUniformLocation(mcSplatProgram, "kernelRadius"), _solver->getParams().h);
+    glUniform3fv(glGetUniformLocation(mcSplatProgram, "gridOrigin"), 1, glm::value_ptr(gridOrigin));
+    glUniform1f(glGetUniformLocation(mcSplatProgram, "gridSpacing"), gridSpacing);
+    glUniform1i(glGetUniformLocation(mcSplatProgram, "gridResolution"), mcResolution);
+    glUniform1f(glGetUniformLocation(mcSplatProgram, "densityScale"), mcDensityScale);
+    glUniform1ui(glGetUniformLocation(mcSplatProgram, "ownedCount"), _solver->getOwnedCount());
+    glUniform1ui(glGetUniformLocation(mcSplatProgram, "sceneFilter"), surfaceScene);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, _solver->getStateBufferId());
+    glDispatchComputeIndirect(SPH::particleDispatchOffset);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    //Classify cells and flag the ones the surface passes through
+    glUseProgram(mcClassifyProgram);
+    glUniform1i(glGetUniformLocation(mcClassifyProgram, "gridResolution"), mcResolution);
+    glUniform1f(glGetUniformLocation(mcClassifyProgram, "isoLevel"), mcIsoLevel);
+    glUniform1f(glGetUniformLocation(mcClassifyProgram, "densityScale"), mcDensityScale);
+    glDispatchCompute((cellCount + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //Compact the active cells and size the generate dispatch from their count
+    prefixSum(cellCount);
+
+    glUseProgram(mcCompactProgram);
+    glUniform1ui(glGetUniformLocation(mcCompactProgram, "cellCount"), cellCount);
+    glDispatchCompute((cellCount + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    //Emit triangles for the active cells only
+    glUseProgram(mcGenerateProgram);
+    glUniform1i(glGetUniformLocation(mcGenerateProgram, "gridResolution"), mcResolution);
+    glUniform3fv(glGetUniformLocation(mcGenerateProgram, "gridOrigin"), 1, glm::value_ptr(gridOrigin));
+    glUniform1f(glGetUniformLocation(mcGenerateProgram, "gridSpacing"), gridSpacing);
+    glUniform1f(glGetUniformLocation(mcGenerateProgram, "isoLevel"), mcIsoLevel);
+    glUniform1f(glGetUniformLocation(mcGenerateProgram, "densityScale"), mcDensityScale);
+    glUniform1ui(glGetUniformLocation(mcGenerateProgram, "vertexCapacity"), mcVertexCapacity);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, mcDispatchBuffer);
+    glDispatchComputeIndirect(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Renderer::prefixSum(GLuint elementCount) {
+    //Exclusive scan from binding 5 into binding 6, the total lands behind the block sums at binding 7
+    GLuint blockCount = (elementCount + 1023) / 1024;
+
+    glUseProgram(scanProgram);
+    glUniform1ui(glGetUniformLocation(scanProgram, "elementCount"), elementCount);
+    for(GLuint stage = 0; stage < 3; stage++){
+        glUniform1ui(glGetUniformLocation(scanProgram, "stage"), stage);
+        glDispatchCompute(stage == 1 ? 1 : blockCount, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
 }
 
 void Renderer::framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -86,15 +346,58 @@ void Renderer::configureBuffers() {
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
 
+    //Only the hot stream is read, position followed by density
     glBindBuffer(GL_ARRAY_BUFFER, _solver->getBufferId());
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, _solver->getParticleSize(), (void*)0);
+    if(_solver->isCompactStorage()){
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, _solver->getParticleSize(), (void*)0);
+        glVertexAttribPointer(2, 1, GL_HALF_FLOAT, GL_FALSE, _solver->getParticleSize(), (void*)6);
+    }else{
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, _solver->getParticleSize(), (void*)0);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, _solver->getParticleSize(), (void*)12);
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(2);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    //Setup culled particle stream and its indirect draw command
+    DrawArraysIndirectCommand command = {0, 1, 0, 0};
+    glGenBuffers(1, &indirectBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glGenBuffers(1, &culledSSBO);
+    glBindBuffer(GL_ARRAY_BUFFER, culledSSBO);
+    glBufferData(GL_ARRAY_BUFFER, _solver->getParticleCapacity() * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenVertexArrays(1, &culledVAO);
+    glBindVertexArray(culledVAO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, _solver->getParticleSize(), (void*)32);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)12);
     glEnableVertexAttribArray(2);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
+    //Setup surface mesh VAO, the buffer is filled whenever the extractor produces a new mesh
+    glGenVertexArrays(1, &meshVAO);
+    glGenBuffers(1, &meshVBO);
+
+    glBindVertexArray(meshVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    configureMarchingCubes();
+
     //Setup Quad VAO
     glGenVertexArrays(1, &quadVAO);
     glGenBuffers(1, &quadVBO);
@@ -156,16 +459,89 @@ void Renderer::configureBuffers() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void Renderer::configureMarchingCubes() {
+    GLuint cells = mcResolution - 1;
+    GLuint cellCount = cells * cells * cells;
+
+    if((cellCount + 1023) / 1024 > 1024){
+        throw std::runtime_error("Marching cubes grid too large for the prefix sum");
+    }
+
+    glGenTextures(1, &mcDensityTexture);
+    glBindTexture(GL_TEXTURE_3D, mcDensityTexture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32UI, mcResolution, mcResolution, mcResolution);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    glGenBuffers(1, &mcTableBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mcTableBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(mcEdgeTable) + sizeof(mcTriTable), nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(mcEdgeTable), mcEdgeTable);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(mcEdgeTable), sizeof(mcTriTable), mcTriTable);
+
+    glGenBuffers(1, &mcCubeIndexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mcCubeIndexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &mcActiveCellBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mcActiveCellBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &scanInputBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scanInputBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &scanOutputBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scanOutputBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &scanBlockSumBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scanBlockSumBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 1025 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    //Dispatch arguments for the generate pass followed by the active cell count
+    glGenBuffers(1, &mcDispatchBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mcDispatchBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    DrawArraysIndirectCommand command = {0, 1, 0, 0};
+    glGenBuffers(1, &mcDrawBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mcDrawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    //Generated vertices are a position and a normal, each padded to a vec4
+    glGenBuffers(1, &mcVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mcVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mcVertexCapacity * 2 * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenVertexArrays(1, &gpuMeshVAO);
+    glBindVertexArray(gpuMeshVAO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)sizeof(glm::vec4));
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
 void Renderer::compileAndLoadShaders(){
+    TRACE_ZONE("Renderer::compileAndLoadShaders");
     pointsProgram = buildShaderFromSource("../shaders/points.vert", "../shaders/points.frag");
     ssfrProgram = buildShaderFromSource("../shaders/ssfr.vert", "../shaders/ssfr.frag");
+    cullProgram = buildShaderFromSource("../shaders/cull.comp");
+    meshProgram = buildShaderFromSource("../shaders/mesh.vert", "../shaders/mesh.frag");
+    mcSplatProgram = buildShaderFromSource("../shaders/mc_splat.comp");
+    mcClassifyProgram = buildShaderFromSource("../shaders/mc_classify.comp");
+    mcCompactProgram = buildShaderFromSource("../shaders/mc_compact.comp");
+    mcGenerateProgram = buildShaderFromSource("../shaders/mc_generate.comp");
+    scanProgram = buildShaderFromSource("../shaders/scan.comp");
 }
 
 GLuint Renderer::buildShaderFromSource(const std::string& filenameVert, const std::string& filenameFrag){
     //Load vertex shader from file and compile via OpenGL
-    std::vector<char> vertFile = readFile(filenameVert);
-    vertFile.push_back('\0');
-    const GLchar* vertexShaderSource = vertFile.data();
+    std::string vertFile = ShaderLoader::loadSource(filenameVert, _solver->getShaderDefines());
+    const GLchar* vertexShaderSource = vertFile.c_str();
 
     unsigned int vertexShader;
     vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -182,9 +558,8 @@ GLuint Renderer::buildShaderFromSource(const std::string& filenameVert, const st
     }
 
     //Load fragment shader from file and compile via OpenGL
-    std::vector<char> fragFile = readFile(filenameFrag);
-    fragFile.push_back('\0');
-    const GLchar* fragmentShaderSource = fragFile.data();
+    std::string fragFile = ShaderLoader::loadSource(filenameFrag, _solver->getShaderDefines());
+    const GLchar* fragmentShaderSource = fragFile.c_str();
 
     unsigned int fragmentShader;
     fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -218,20 +593,39 @@ GLuint Renderer::buildShaderFromSource(const std::string& filenameVert, const st
     return shaderProgram;
 }
 
-std::vector<char> Renderer::readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+GLuint Renderer::buildShaderFromSource(const std::string& filenameComp){
+    //Load compute shader from file and compile via OpenGL
+    std::string compFile = ShaderLoader::loadSource(filenameComp, _solver->getShaderDefines());
+    const GLchar* computeShaderSource = compFile.c_str();
+
+    GLuint computeShader;
+    computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShader, 1, &computeShaderSource, NULL);
+    glCompileShader(computeShader);
 
-	if (!file.is_open()) {
-		throw std::runtime_error("Failed to open file!");
-	}
+    //Check for errors
+    int success;
+    char infoLog[512];
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+    if(!success){
+        glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+        throw std::runtime_error("Compute shader failed to compile:\n" + std::string(infoLog));
+    }
 
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
+    //Create a shaderProgram
+    unsigned int shaderProgram;
+    shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, computeShader);
+    glLinkProgram(shaderProgram);
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
+    //Check for errors
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if(!success){
+        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        throw std::runtime_error("Program failed to link shaders:\n" + std::string(infoLog));
+    }
 
-	file.close();
+    glDeleteShader(computeShader);
 
-	return buffer;
-}
\ No newline at end of file
+    return shaderProgram;
+}
@@ -0,0 +1,68 @@
+#include "ShaderLoader.h"
+
+#include <sstream>
+
+std::string ShaderLoader::loadSource(const std::string& filename, const std::vector<std::string>& defines){
+    TRACE_ZONE("ShaderLoader::loadSource");
+    std::string source = resolveIncludes(filename, 0);
+
+    //Defines have to follow the #version line
+    size_t versionStart = source.find("#version");
+    size_t insertAt = versionStart == std::string::npos ? 0 : source.find('\n', versionStart) + 1;
+
+    std::string defineBlock;
+    for(const std::string& define : defines){
+        defineBlock += "#define " + define + "\n";
+    }
+
+    source.insert(insertAt, defineBlock);
+    return source;
+}
+
+std::string ShaderLoader::resolveIncludes(const std::string& filename, int depth){
+    if(depth > 8){
+        throw std::runtime_error("Shader includes nested too deeply in " + filename);
+    }
+
+    std::string directory = filename.substr(0, filename.find_last_of('/') + 1);
+
+    std::istringstream source(readFile(filename));
+    std::string result;
+    std::string line;
+
+    while(std::getline(source, line)){
+        size_t directive = line.find("#include");
+        if(directive == std::string::npos){
+            result += line + "\n";
+            continue;
+        }
+
+        size_t open = line.find('"', directive);
+        size_t close = line.find('"', open + 1);
+        if(open == std::string::npos || close == std::string::npos){
+            throw std::runtime_error("Malformed #include in " + filename);
+        }
+
+        result += resolveIncludes(directory + line.substr(open + 1, close - open - 1), depth + 1);
+    }
+
+    return result;
+}
+
+std::string ShaderLoader::readFile(const std::string& filename){
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    size_t fileSize = (size_t) file.tellg();
+    std::string buffer(fileSize, '\0');
+
+    file.seekg(0);
+    file.read(&buffer[0], fileSize);
+
+    file.close();
+
+    return buffer;
+}
@@ -0,0 +1,54 @@
+#include "SimParams.h"
+
+SimParams SimParams::load(const std::string& filename){
+    std::ifstream file(filename);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open parameter file " + filename);
+    }
+
+    SimParams params;
+    std::string line;
+    int lineNumber = 0;
+
+    while(std::getline(file, line)){
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream stream(line);
+        std::string name;
+        if(!(stream >> name)) continue;
+
+        bool ok;
+        if(name == "particles") ok = (bool)(stream >> params.particleCount);
+        else if(name == "substeps") ok = (bool)(stream >> params.substeps);
+        else if(name == "timestep") ok = (bool)(stream >> params.timestep);
+        else if(name == "h") ok = (bool)(stream >> params.h);
+        else if(name == "stiffness") ok = (bool)(stream >> params.stiffness);
+        else if(name == "rest_density") ok = (bool)(stream >> params.restDensity);
+        else if(name == "viscosity") ok = (bool)(stream >> params.viscosity);
+        else if(name == "mass") ok = (bool)(stream >> params.mass);
+        else if(name == "damping") ok = (bool)(stream >> params.damping);
+        else if(name == "gravity") ok = (bool)(stream >> params.gravity.x >> params.gravity.y >> params.gravity.z);
+        else if(name == "sleep_velocity") ok = (bool)(stream >> params.sleepVelocity);
+        else if(name == "sleep_density_change") ok = (bool)(stream >> params.sleepDensityChange);
+        else if(name == "sleep_steps") ok = (bool)(stream >> params.sleepSteps);
+        else if(name == "split_density") ok = (bool)(stream >> params.splitDensity);
+        else if(name == "merge_density") ok = (bool)(stream >> params.mergeDensity);
+        else throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown parameter " + name);
+
+        if(!ok) throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": bad value for " + name);
+    }
+
+    params.validate();
+    return params;
+}
+
+void SimParams::validate() const{
+    //The grid has one cell per smoothing length over the [-1, 1] domain, 128 cells per axis at most
+    if(!(h >= 2.0f / 128.0f && h <= 2.0f)) throw std::runtime_error("h must lie in [" + std::to_string(2.0f / 128.0f) + ", 2]");
+    if(particleCount < 1) throw std::runtime_error("Need at least one particle");
+    if(substeps < 1) throw std::runtime_error("Need at least one substep");
+    if(!(timestep > 0.0f)) throw std::runtime_error("Timestep must be positive");
+    if(!(mass > 0.0f) || !(restDensity > 0.0f)) throw std::runtime_error("Mass and rest density must be positive");
+    if(sleepSteps < 1) throw std::runtime_error("Sleep steps must be positive");
+}
@@ -0,0 +1,94 @@
+#include "SimulationAPI.h"
+
+#include <string>
+
+#include "Solver.h"
+#include "ThreadPool.h"
+#include "Window.h"
+
+struct Simulation{
+    Window window;
+    ThreadPool threadPool;
+    SPH solver;
+};
+
+static thread_local std::string lastError;
+
+//Exceptions must not cross into C, they are turned into an error code and a message
+template<typename Result, typename Call>
+static Result guarded(Result failure, Call call){
+    try{
+        return call();
+    }catch(const std::exception& e){
+        lastError = e.what();
+        return failure;
+    }
+}
+
+Simulation* fluidsim_create(const char* paramsFile, const char* shaderDirectory, int flags){
+    return guarded<Simulation*>(nullptr, [&](){
+        Simulation* simulation = new Simulation();
+        try{
+            SPH& solver = simulation->solver;
+            if(paramsFile != nullptr) solver.setParams(SimParams::load(paramsFile));
+            if(shaderDirectory != nullptr) solver.setShaderDirectory(shaderDirectory);
+            solver.setDeterministic(flags & SIMULATION_DETERMINISTIC);
+            solver.setSleeping(flags & SIMULATION_SLEEP);
+            solver.setBoundaryParticles(flags & SIMULATION_BOUNDARY_PARTICLES);
+            solver.setMappedStreams(true);
+
+            simulation->window.init(1, 1, "3D SPH Fluid Sim (headless)", false);
+            simulation->threadPool.init();
+            solver.init(&simulation->threadPool);
+            solver.syncMappedStreams();
+        }catch(...){
+            delete simulation;
+            throw;
+        }
+        return simulation;
+    });
+}
+
+void fluidsim_destroy(Simulation* simulation){
+    if(simulation == nullptr) return;
+
+    simulation->solver.cleanup();
+    simulation->threadPool.cleanup();
+    simulation->window.cleanup();
+    delete simulation;
+}
+
+int fluidsim_step(Simulation* simulation, int steps){
+    return guarded<int>(-1, [&](){
+        simulation->solver.advance(steps);
+        simulation->solver.syncMappedStreams();
+        return 0;
+    });
+}
+
+int fluidsim_particle_count(Simulation* simulation){
+    return guarded<int>(-1, [&](){ return simulation->solver.getParticleCount(); });
+}
+
+int fluidsim_particle_capacity(Simulation* simulation){
+    return simulation->solver.getParticleCapacity();
+}
+
+float* fluidsim_stream(Simulation* simulation, int stream){
+    return guarded<float*>(nullptr, [&](){
+        if(stream < 0 || stream > 2) throw std::runtime_error("Stream " + std::to_string(stream) + " does not exist, there are hot, warm and cold");
+        return static_cast<float*>(simulation->solver.getMappedStream(stream));
+    });
+}
+
+float fluidsim_stiffness(Simulation* simulation){
+    return simulation->solver.getParams().stiffness;
+}
+
+float fluidsim_rest_density(Simulation* simulation){
+    return simulation->solver.getParams().restDensity;
+}
+
+const char* fluidsim_last_error(){
+    return lastError.c_str();
+}
@@ -1,23 +1,193 @@
 #include "Solver.h"
 
-void SPH::init(){
-    _particleCount = particleCount;
+void SPH::setParams(const SimParams& newParams){
+    if(!ensemble.empty()) throw std::runtime_error("Ensemble scenes are fixed once set, see setEnsemble");
+    newParams.validate();
+    bool gridChanged = newParams.h != params.h;
+    params = newParams;
 
-    //Initialize Random Particles
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    if(!initialized) return;
+    if(gridChanged) resizeGrid();
+    uploadParams();
+}
+
+const SimParams& SPH::getParams(){
+    return params;
+}
+
+void SPH::reset(){
+    spawnParticles();
+    emitSeed = 0;
+    for(Emitter& emitter : emitters) emitter.accumulated = 0.0f;
+
+    if(sleeping){
+        glClearNamedBufferData(cellSleepSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        awakeStepTime = 0.0;
+        stepsTaken = 0;
+        stepTimer.reset();
+    }
+
+    writeParticles(particles, particles.size());
+    statsStep = 0;
+    simulatedTime = 0.0;
+    accumulator = std::chrono::duration<double>(0.0);
+    firstLoop = true;
+}
+
+void SPH::setCompactStorage(bool compact){
+    compactStorage = compact;
+}
+
+bool SPH::isCompactStorage(){
+    return compactStorage;
+}
+
+bool SPH::isAdaptiveResolution(){
+    return adaptiveResolution;
+}
+
+void SPH::setSleeping(bool sleeping){
+    this->sleeping = sleeping;
+}
+
+void SPH::setAdaptiveResolution(bool adaptive){
+    adaptiveResolution = adaptive;
+}
+
+std::vector<std::string> SPH::getShaderDefines(){
+    std::vector<std::string> defines;
+    if(compactStorage) defines.push_back("COMPACT_PARTICLES");
+    if(sleeping) defines.push_back("SLEEPING_PARTICLES");
+    if(boundaryParticles) defines.push_back("BOUNDARY_PARTICLES");
+    if(domainGhosts) defines.push_back("DOMAIN_GHOSTS");
+    if(!ensemble.empty()) defines.push_back("ENSEMBLE");
+    return defines;
+}
+
+void SPH::setParticleCapacity(int capacity){
+    if(capacity > maxParticleCapacity) throw std::runtime_error("Particle capacity exceeds " + std::to_string(maxParticleCapacity));
+    _particleCapacity = capacity;
+}
+
+void SPH::addEmitter(const Emitter& emitter){
+    emitters.push_back(emitter);
+}
+
+void SPH::addSink(const Sink& sink){
+    int sameType = std::count_if(sinks.begin(), sinks.end(), [&](const Sink& other){ return other.type == sink.type; });
+    if(sameType >= maxSinks) throw std::runtime_error("At most " + std::to_string(maxSinks) + " sinks per type are supported");
+    sinks.push_back(sink);
+}
+
+void SPH::setBoundaryMesh(const std::string& filename){
+    boundaryMesh = filename;
+}
+
+void SPH::setBoundaryParticles(bool enabled){
+    boundaryParticles = enabled;
+}
+
+void SPH::setDeterministic(bool deterministic){
+    this->deterministic = deterministic;
+}
+
+void SPH::setDomainGhosts(bool enabled){
+    domainGhosts = enabled;
+}
+
+void SPH::setEnsemble(const std::vector<SimParams>& scenes){
+    if(scenes.empty()) throw std::runtime_error("An ensemble needs at least one scene");
+
+    //All scenes run through the same grid and substeps with the same mass, only the terms a sweep varies may differ
+    int total = 0;
+    for(const SimParams& scene : scenes){
+        scene.validate();
+        if(scene.h != scenes[0].h || scene.timestep != scenes[0].timestep || scene.substeps != scenes[0].substeps || scene.mass != scenes[0].mass){
+            throw std::runtime_error("Ensemble scenes have to share h, timestep, substeps and mass");
+        }
+        total += scene.particleCount;
+    }
+    if(total > maxParticleCapacity) throw std::runtime_error("Ensemble of " + std::to_string(total) + " particles exceeds " + std::to_string(maxParticleCapacity));
+
+    ensemble = scenes;
+    params = scenes[0];
+}
+
+int SPH::getSceneCount(){
+    return std::max<int>(ensemble.size(), 1);
+}
+
+const SimParams& SPH::getSceneParams(int scene){
+    return ensemble.empty() ? params : ensemble[scene];
+}
+
+void SPH::setMappedStreams(bool mapped){
+    mappedStreams = mapped;
+}
+
+void* SPH::getMappedStream(int stream){
+    if(!mappedStreams) throw std::runtime_error("Particle streams are not mapped, see setMappedStreams");
+    return streamPointers[stream];
+}
+
+void SPH::syncMappedStreams(){
+    //Coherent mappings still need the shader writes flushed and finished before the CPU looks
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED){}
+    glDeleteSync(fence);
+}
 
-    particles = std::vector<particle>(particleCount);
-    
-    for (particle& p : particles){
-        p.position = glm::vec4(dist(mt), dist(mt), dist(mt), 0.0);
-        //p.velocity = glm::vec4(dist(mt) * 0.1, dist(mt) * 0.1, dist(mt) * 0.1, 0.0);
+void SPH::setShaderDirectory(const std::string& directory){
+    shaderDirectory = directory.empty() || directory.back() == '/' ? directory : directory + "/";
+}
+
+void SPH::setStepHook(const std::function<void()>& hook){
+    stepHook = hook;
+}
+
+void SPH::setGridStatistics(int interval){
+    if(interval < 0) throw std::runtime_error("Grid statistics interval must not be negative");
+    statsInterval = interval;
+}
+
+const GridStats& SPH::getGridStats(){
+    return gridStats;
+}
+
+int SPH::getGridStatsStep(){
+    return gridStatsStep;
+}
+
+void SPH::init(ThreadPool* threadPool){
+    TRACE_ZONE("SPH::init");
+    params.validate();
+
+    //Compaction and sleeping reorder or skip particles behind the ghost exchange's back
+    if(domainGhosts && (!emitters.empty() || !sinks.empty() || adaptiveResolution || sleeping)){
+        throw std::runtime_error("Domain decomposition does not support emitters, sinks, adaptive resolution or sleeping");
     }
 
-    //Derive Grid Dimensions from h (needs to be at least h x h per grid box)
-    size_t gridLength = ceil(2.0 / h);
-    size_t gridSize = gridLength * gridLength * gridLength;
+    //Splits claim their slots with an atomic counter, so particle indices and with them the sum order would vary
+    if(deterministic && adaptiveResolution){
+        throw std::runtime_error("Deterministic mode does not support adaptive resolution");
+    }
+
+    //Scene slots and grid layers are fixed, nothing may remove, append or skip particles
+    if(!ensemble.empty() && (!emitters.empty() || !sinks.empty() || adaptiveResolution || sleeping || domainGhosts)){
+        throw std::runtime_error("Ensemble mode does not support emitters, sinks, adaptive resolution, sleeping or domain decomposition");
+    }
+
+    this->threadPool = threadPool;
+    spawnParticles();
+
+    int particleCount = particles.size();
+    _particleCapacity = std::max(_particleCapacity, particleCount);
+    ownedCount = particleCount;
+
+    //Derive Grid Dimensions from h (needs to be at least h x h per grid box), one layer per ensemble scene
+    GLuint gridLength = getGridLength();
+    gridSize = gridLength * gridLength * gridLength * getSceneCount();
 
     accumulator = std::chrono::duration<double>(0.0);
     firstLoop = true;
@@ -27,77 +197,1076 @@ void SPH::init(){
         throw std::runtime_error("Failed to initialize GLAD");
     }
 
-    glGenBuffers(1, &particleSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSSBO);
+    //Split the particles into their hot, warm and cold streams, allocated for the full capacity
+    std::vector<glm::vec4> cold(particleCount, glm::vec4(0.0f));
+    tagScenes(cold);
+    size_t hotSize = _particleCapacity * getParticleSize();
+    size_t warmSize = _particleCapacity * getWarmSize();
+    size_t coldSize = _particleCapacity * sizeof(glm::vec4);
+
+    hotSSBO = createStream(0, hotSize);
+    warmSSBO = createStream(1, warmSize);
+
+    if(compactStorage){
+        std::vector<glm::uvec2> hot(particleCount), warm(particleCount);
+        for(int i = 0; i < particleCount; i++){
+            hot[i] = packHot(particles[i]);
+            warm[i] = packWarm(particles[i]);
+        }
+
+        glNamedBufferSubData(hotSSBO, 0, hot.size() * sizeof(glm::uvec2), hot.data());
+        glNamedBufferSubData(warmSSBO, 0, warm.size() * sizeof(glm::uvec2), warm.data());
+
+        reportStorageError();
+    }else{
+        std::vector<glm::vec4> hot(particleCount), warm(particleCount);
+        for(int i = 0; i < particleCount; i++){
+            hot[i] = glm::vec4(glm::vec3(particles[i].position), particles[i].properties.x);
+            warm[i] = particles[i].velocity;
+        }
+
+        glNamedBufferSubData(hotSSBO, 0, hot.size() * sizeof(glm::vec4), hot.data());
+        glNamedBufferSubData(warmSSBO, 0, warm.size() * sizeof(glm::vec4), warm.data());
+    }
+
+    coldSSBO = createStream(2, coldSize);
+    glNamedBufferSubData(coldSSBO, 0, cold.size() * sizeof(glm::vec4), cold.data());
+
+    //Scratch space handing accelerations from the force pass to the integration
+    glGenBuffers(1, &accelerationSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, accelerationSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
 
     glGenBuffers(1, &gridSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, gridSize * sizeof(uint), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gridSSBO);
 
     glGenBuffers(1, &listSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, listSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, particleCount * sizeof(uint), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, listSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(uint), nullptr, GL_DYNAMIC_DRAW);
+
+    //Live count and indirect arguments, only ever written by sph_update_state.comp after this
+    SimState state = {};
+    state.particleDispatch[0] = (particleCount + 255) / 256;
+    state.particleDispatch[1] = state.particleDispatch[2] = 1;
+    state.liveCount = particleCount;
+    state.particleDraw[0] = particleCount;
+    state.particleDraw[1] = 1;
+    state.scanDispatch[0] = (particleCount + 1023) / 1024;
+    state.scanDispatch[1] = state.scanDispatch[2] = 1;
+    state.activeDispatch[0] = state.particleDispatch[0];
+    state.activeDispatch[1] = state.activeDispatch[2] = 1;
+    state.activeCount = particleCount;
+
+    glGenBuffers(1, &stateSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SimState), &state, GL_DYNAMIC_DRAW);
+
+    //Compaction scratch, survivors are scattered here and copied back so the stream ids stay stable
+    glGenBuffers(1, &aliveFlagSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, aliveFlagSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &aliveOffsetSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, aliveOffsetSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &blockSumSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, blockSumSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 1025 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &hotScratchSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, hotScratchSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, hotSize, nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &warmScratchSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, warmScratchSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, warmSize, nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &coldScratchSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, coldScratchSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, coldSize, nullptr, GL_DYNAMIC_COPY);
+
+    //Per cell sleep state and the list of particles the substeps visit
+    if(sleeping){
+        glGenBuffers(1, &cellSleepSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSleepSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, gridSize * sizeof(glm::uvec4), nullptr, GL_DYNAMIC_DRAW);
+        glClearNamedBufferData(cellSleepSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+        glGenBuffers(1, &activeListSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, activeListSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+        stepTimer.init(4, "step");
+    }
+
+    if(deterministic){
+        sortTimer.init(32, "cell sort");
+        passTimer.init(32, "passes");
+    }
+
+    if(adaptiveResolution){
+        glGenBuffers(1, &mergePartnerSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mergePartnerSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, _particleCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    //Grid statistics, the readback buffers are only ever copied into and read from the CPU
+    if(statsInterval > 0){
+        glGenBuffers(1, &statsSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GridStats), nullptr, GL_DYNAMIC_COPY);
+
+        for(StatsReadback& readback : statsReadback){
+            glGenBuffers(1, &readback.buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GridStats), nullptr, GL_STREAM_READ);
+            readback.fence = nullptr;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        nextStatsReadback = 0;
+        gridStatsStep = -1;
+    }
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    glGenBuffers(1, &paramsUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, paramsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(SimParamsBlock), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploadParams();
+
+    if(!ensemble.empty()){
+        glGenBuffers(1, &sceneSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sceneSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, ensemble.size() * sizeof(SceneParamsBlock), nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        uploadScenes();
+    }
+
+    buildBoundary();
     compileAndLoadShaders();
+    initialized = true;
+}
+
+GLuint SPH::createStream(int stream, size_t size){
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+    if(!mappedStreams){
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        return buffer;
+    }
+
+    //Immutable storage mapped once for the buffer's lifetime, compaction only ever copies into it so the pointer stays valid
+    GLbitfield access = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, access | GL_DYNAMIC_STORAGE_BIT);
+    streamPointers[stream] = glMapNamedBufferRange(buffer, 0, size, access);
+    if(streamPointers[stream] == nullptr) throw std::runtime_error("Failed to map particle stream " + std::to_string(stream));
+    return buffer;
+}
+
+void SPH::spawnParticles(){
+    //Random particles over the whole domain, from a fixed seed in deterministic mode, ensemble scenes one after the other
+    std::random_device rd;
+    std::mt19937 mt(deterministic ? deterministicSeed : rd());
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    particles.clear();
+    sceneOffsets.assign(1, 0);
+
+    for(int scene = 0; scene < getSceneCount(); scene++){
+        for(int i = 0; i < getSceneParams(scene).particleCount; i++){
+            particle p;
+            p.position = glm::vec4(dist(mt), dist(mt), dist(mt), 0.0);
+            p.velocity = glm::vec4(0.0f, 0.0f, 0.0f, params.mass);
+            p.properties = glm::vec4(0.0f);
+            particles.push_back(p);
+        }
+        sceneOffsets.push_back(particles.size());
+    }
+}
+
+void SPH::tagScenes(std::vector<glm::vec4>& cold){
+    //The scene id rides in the cold stream's first user attribute, see loadScene in particle.glsl
+    for(size_t scene = 0; scene + 1 < sceneOffsets.size(); scene++){
+        for(int i = sceneOffsets[scene]; i < sceneOffsets[scene + 1] && i < (int)cold.size(); i++) cold[i].z = scene;
+    }
+}
+
+void SPH::uploadParams(){
+    SimParamsBlock block = {};
+    block.g = params.gravity;
+    block.timestep = params.timestep;
+    block.h = params.h;
+    block.k = params.stiffness;
+    block.p0 = params.restDensity;
+    block.mu = params.viscosity;
+    block.mass = params.mass;
+    block.minMass = params.mass / 8.0f;
+    block.damping = params.damping;
+    block.sleepVelocity = params.sleepVelocity;
+    block.sleepDensityChange = params.sleepDensityChange;
+    block.sleepSteps = params.sleepSteps;
+    block.splitDensity = params.splitDensity;
+    block.mergeDensity = params.mergeDensity;
+    block.gridLength = getGridLength();
+
+    glNamedBufferSubData(paramsUBO, 0, sizeof(SimParamsBlock), &block);
+}
+
+void SPH::uploadScenes(){
+    std::vector<SceneParamsBlock> blocks(ensemble.size());
+    for(size_t i = 0; i < ensemble.size(); i++){
+        const SimParams& scene = ensemble[i];
+        blocks[i] = {scene.stiffness, scene.restDensity, scene.viscosity, scene.damping, glm::vec4(scene.gravity, 0.0f)};
+    }
+
+    glNamedBufferSubData(sceneSSBO, 0, blocks.size() * sizeof(SceneParamsBlock), blocks.data());
+}
+
+GLuint SPH::getGridLength(){
+    return (GLuint)std::ceil((domainMax - domainMin) / params.h);
+}
+
+void SPH::resizeGrid(){
+    //Buffer names stay the same, so nothing that binds them has to know
+    GLuint gridLength = getGridLength();
+    gridSize = gridLength * gridLength * gridLength * getSceneCount();
+
+    glNamedBufferData(gridSSBO, gridSize * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+    if(sleeping){
+        glNamedBufferData(cellSleepSSBO, gridSize * sizeof(glm::uvec4), nullptr, GL_DYNAMIC_DRAW);
+        glClearNamedBufferData(cellSleepSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    }
+
+    //Boundary particles are binned by cell and weighted with the kernel, both depend on h
+    if(boundaryParticles){
+        glDeleteBuffers(1, &boundaryCellSSBO);
+        glDeleteBuffers(1, &boundaryParticleSSBO);
+        buildBoundaryParticles(loadBoundaryMesh());
+    }
+}
+
+TriangleMesh SPH::loadBoundaryMesh(){
+    return boundaryMesh.empty() ? TriangleMesh::box(glm::vec3(domainMin), glm::vec3(domainMax), true) : TriangleMesh::loadOBJ(boundaryMesh);
+}
+
+void SPH::buildBoundary(){
+    TRACE_ZONE("SPH::buildBoundary");
+    //The field covers the domain plus a smoothing length, so particles clamped to the domain always sample inside it
+    TriangleMesh mesh = loadBoundaryMesh();
+    //Only user meshes are cached, the built-in box bakes quickly and should not leave files in the working directory
+    std::string cacheFile = boundaryMesh.empty() ? std::string() : boundaryMesh + ".sdf";
+    boundary.build(threadPool, mesh, glm::vec3(domainMin - params.h), glm::vec3(domainMax + params.h), cacheFile);
+    if(boundaryParticles) buildBoundaryParticles(mesh);
+
+    glGenTextures(1, &boundaryTexture);
+    glBindTexture(GL_TEXTURE_3D, boundaryTexture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, BoundarySDF::resolution, BoundarySDF::resolution, BoundarySDF::resolution, 0, GL_RGBA, GL_FLOAT, boundary.getSamples().data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void SPH::buildBoundaryParticles(const TriangleMesh& mesh){
+    float h = params.h;
+    float spacing = 0.5f * h;
+    int cellsPerAxis = getGridLength();
+    std::vector<glm::vec3> positions = mesh.sampleSurface(spacing);
+
+    //Sort by grid cell, so the passes walk a cell's boundary particles as one contiguous range
+    std::vector<std::pair<int, glm::vec3>> sorted(positions.size());
+    for(size_t i = 0; i < positions.size(); i++){
+        sorted[i] = {getCellIndex(positions[i]), positions[i]};
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+
+    //Every ensemble scene sees the same walls, so the boundary only covers a single layer of the grid
+    std::vector<glm::uvec2> cells((size_t)cellsPerAxis * cellsPerAxis * cellsPerAxis, glm::uvec2(0));
+    for(size_t i = 0; i < sorted.size(); i++){
+        glm::uvec2& cell = cells[sorted[i].first];
+        if(cell.y == 0) cell.x = i;
+        cell.y++;
+    }
+
+    //Akinci volume weights, psi = rest density / sum of the kernel over the neighboring boundary particles,
+    //so densely sampled patches weigh less per particle and the wall contributes the same everywhere
+    std::vector<glm::vec4> particles(sorted.size());
+    threadPool->parallelFor(sorted.size(), [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            int flat = sorted[i].first;
+            glm::ivec3 cell = glm::ivec3(flat % cellsPerAxis, (flat / cellsPerAxis) % cellsPerAxis, flat / (cellsPerAxis * cellsPerAxis));
+            float kernelSum = 0.0f;
+
+            for(int z = -1; z <= 1; z++)
+            for(int y = -1; y <= 1; y++)
+            for(int x = -1; x <= 1; x++){
+                glm::ivec3 neighbor = cell + glm::ivec3(x, y, z);
+                if(glm::clamp(neighbor, glm::ivec3(0), glm::ivec3(cellsPerAxis - 1)) != neighbor) continue;
+
+                glm::uvec2 range = cells[neighbor.x + cellsPerAxis * (neighbor.y + cellsPerAxis * neighbor.z)];
+                for(uint32_t j = range.x; j < range.x + range.y; j++){
+                    float r = glm::length(sorted[i].second - sorted[j].second);
+                    if(r < h) kernelSum += poly6(r, h);
+                }
+            }
+
+            particles[i] = glm::vec4(sorted[i].second, params.restDensity / kernelSum);
+        }
+    });
+
+    glGenBuffers(1, &boundaryCellSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundaryCellSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cells.size() * sizeof(glm::uvec2), cells.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &boundaryParticleSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundaryParticleSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, particles.size()) * sizeof(glm::vec4), particles.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    float minPsi = std::numeric_limits<float>::max(), maxPsi = 0.0f;
+    for(const glm::vec4& p : particles){
+        minPsi = std::min(minPsi, p.w);
+        maxPsi = std::max(maxPsi, p.w);
+    }
+    std::cout << "Boundary particles: " << particles.size() << " at spacing " << spacing
+              << ", volume weights " << minPsi << " to " << maxPsi << " (fluid particle mass " << params.mass << ")" << std::endl;
+}
 
-    hLocation = glGetUniformLocation(updateProgram, "h");
+int SPH::getCellIndex(const glm::vec3& position){
+    //Same cells as getCellIndex in sph_common.glsl, clamped into the grid
+    int cells = getGridLength();
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((position - domainMin) / params.h)), glm::ivec3(0), glm::ivec3(cells - 1));
+    return cell.x + cells * (cell.y + cells * cell.z);
+}
+
+float SPH::poly6(float r, float h){
+    return 315.0f / 64.0f / M_PI / std::pow(h, 9) * std::pow(h * h - r * r, 3);
 }
 
 void SPH::mainLoop() {
+    TRACE_ZONE("SPH::mainLoop");
     if(firstLoop) initializeFirstLoop();
+
+    //Last frame's stage marks become GPU spans in the trace once the GPU got through them
+    if(Trace::isEnabled()){
+        GpuTimer::calibrateTraceClock();
+        GLuint available = 0;
+        if(stageMarkCount > 0) glGetQueryObjectuiv(stageQueries[stageMarkCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) resolveStageTimes();
+    }
+
+    if(statsInterval > 0) collectGridStats();
+
     auto newTime = std::chrono::high_resolution_clock::now();
     auto stepTime = newTime - currentTime;
     currentTime = newTime;
     accumulator += stepTime;
 
+    bindBuffers();
+    if(sleeping) stepTimer.begin();
+
+    int steps = 0;
+
     while(accumulator >= fixedTimeStep){
-        for(int i=0; i < 10; i++){ //use substeps for greater numerical stability
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSSBO);
-            glUseProgram(updateProgram);
-            glUniform1f(hLocation, h);
-            glDispatchCompute(1, 1, 1);
-            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        fixedStep();
+        accumulator -= fixedTimeStep;
+        steps++;
+    }
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+    if(sleeping){
+        stepTimer.end(steps);
+        stepsTaken += steps;
+
+        //Nothing can sleep during the first sleepSteps steps, which makes them the all awake reference
+        if(awakeStepTime == 0.0 && stepsTaken >= params.sleepSteps && stepTimer.getSampleWeight() > 0){
+            awakeStepTime = stepTimer.getAverage();
+            stepTimer.reset();
         }
 
-        accumulator -= fixedTimeStep;
     }
+
+    if((sleeping || adaptiveResolution || deterministic) && ++framesSinceReport >= reportInterval){
+        if(sleeping) reportSleeping();
+        if(adaptiveResolution) reportAdaptiveResolution();
+        if(deterministic && !sleeping) reportDeterministic();
+        framesSinceReport = 0;
+    }
+}
+
+void SPH::advance(int steps){
+    TRACE_ZONE("SPH::advance");
+    bindBuffers();
+    for(int i = 0; i < steps; i++){
+        fixedStep();
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+    if(statsInterval > 0) collectGridStats();
+}
+
+void SPH::bindBuffers(){
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, hotSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, warmSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, coldSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gridSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, listSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, accelerationSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, stateSSBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, paramsUBO);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, stateSSBO);
+    glBindTextureUnit(2, boundaryTexture);
+    if(boundaryParticles){
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, boundaryCellSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, boundaryParticleSSBO);
+    }
+    if(!ensemble.empty()){
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, sceneSSBO);
+    }
+    if(sleeping){
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellSleepSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, activeListSSBO);
+    }
+}
+
+void SPH::fixedStep(){
+    TRACE_ZONE("SPH::fixedStep");
+    GLuint emptyCell = 0xffffffff;
+
+    if(stepHook) stepHook();
+    markStage(-1);
+
+    if(sleeping){
+        updateSleeping();
+        markStage(STAGE_SLEEP);
+    }
+
+    for(int i=0; i < params.substeps; i++){ //use substeps for greater numerical stability
+        //Rebuild the grid's linked lists
+        glClearNamedBufferData(gridSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &emptyCell);
+        glClearNamedBufferData(listSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &emptyCell);
+        dispatchPass(insertProgram);
+        markStage(STAGE_INSERT);
+
+        if(deterministic){
+            sortCells();
+            markStage(STAGE_SORT);
+        }
+
+        //Sampled on the first substep's grid, the later ones barely differ
+        if(i == 0 && statsInterval > 0 && statsStep % statsInterval == 0){
+            gatherGridStats();
+            markStage(STAGE_STATS);
+        }
+
+        //Each pass only binds the streams it touches, see particle.glsl, sleeping times the whole step itself
+        bool timed = deterministic && !sleeping;
+        if(timed) passTimer.begin();
+        dispatchPass(densityProgram);
+        markStage(STAGE_DENSITY);
+        dispatchPass(forceProgram);
+        markStage(STAGE_FORCE);
+        dispatchPass(integrateProgram);
+        markStage(STAGE_INTEGRATE);
+        if(timed) passTimer.end();
+    }
+
+    if(!emitters.empty() || !sinks.empty() || adaptiveResolution){
+        removeAndEmitParticles(params.substeps * params.timestep);
+        markStage(STAGE_EMIT);
+    }
+
+    statsStep++;
+    simulatedTime += params.substeps * params.timestep;
+}
+
+double SPH::getSimulatedTime(){
+    return simulatedTime;
+}
+
+void SPH::setStageTiming(bool enabled){
+    stageTiming = enabled;
+    stageTimes.assign(STAGE_COUNT, 0.0);
+}
+
+void SPH::markStage(int stage){
+    //Timestamps do not nest like elapsed time queries, so they can sit inside the other timers' spans
+    if(!stageTiming && !Trace::isEnabled()) return;
+
+    if(stageMarkCount == stageQueries.size()){
+        stageQueries.push_back(0);
+        glGenQueries(1, &stageQueries.back());
+        stageMarks.push_back(-1);
+    }
+
+    glQueryCounter(stageQueries[stageMarkCount], GL_TIMESTAMP);
+    stageMarks[stageMarkCount] = stage;
+    stageMarkCount++;
+}
+
+void SPH::resolveStageTimes(){
+    //Every mark closes the stage that ran since the previous one, -1 only opens a step
+    GLuint64 previous = 0;
+    for(size_t i = 0; i < stageMarkCount; i++){
+        GLuint64 timestamp;
+        glGetQueryObjectui64v(stageQueries[i], GL_QUERY_RESULT, &timestamp);
+        if(stageMarks[i] >= 0 && i > 0){
+            if(stageTiming) stageTimes[stageMarks[i]] += (timestamp - previous) / 1.0e6;
+            Trace::recordGpu(stageNames[stageMarks[i]], previous, timestamp);
+        }
+        previous = timestamp;
+    }
+    stageMarkCount = 0;
+}
+
+std::vector<double> SPH::getStageTimes(){
+    resolveStageTimes();
+    return stageTimes;
+}
+
+void SPH::resetStageTimes(){
+    resolveStageTimes();
+    stageTimes.assign(STAGE_COUNT, 0.0);
+}
+
+void SPH::dispatchPass(GLuint program){
+    TRACE_ZONE("SPH::dispatchPass");
+    //Sized by the live count on the GPU, see simStateBuffer in particle.glsl, the grid insertion always visits everyone
+    glUseProgram(program);
+    setPassUniforms(program);
+    glDispatchComputeIndirect(sleeping && program != insertProgram ? activeDispatchOffset : particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void SPH::setPassUniforms(GLuint program){
+    //Uniforms from sph_common.glsl, passes that do not use them simply get -1 locations
+    glm::vec3 origin = boundary.getOrigin();
+    glm::vec3 extent = boundary.getExtent();
+    glUniform3fv(glGetUniformLocation(program, "boundaryOrigin"), 1, &origin[0]);
+    glUniform3fv(glGetUniformLocation(program, "boundaryExtent"), 1, &extent[0]);
+    glUniform1ui(glGetUniformLocation(program, "ownedCount"), ownedCount);
+}
+
+void SPH::updateSleeping(){
+    TRACE_ZONE("SPH::updateSleeping");
+    //Age the cells, decide who sleeps and rebuild the active list from scratch
+    GLuint zero = 0;
+    glClearNamedBufferSubData(stateSSBO, GL_R32UI, offsetof(SimState, activeCount), sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    glUseProgram(sleepProgram);
+    setPassUniforms(sleepProgram);
+    glUniform1ui(glGetUniformLocation(sleepProgram, "cellCount"), gridSize);
+    for(GLuint stage = 0; stage < 3; stage++){
+        glUniform1ui(glGetUniformLocation(sleepProgram, "stage"), stage);
+        if(stage < 2) glDispatchCompute((gridSize + 255) / 256, 1, 1);
+        else glDispatchComputeIndirect(particleDispatchOffset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    updateState(2, 0);
+}
+
+void SPH::reportSleeping(){
+    double stepTime = stepTimer.getAverage();
+
+    SimState state;
+    glGetNamedBufferSubData(stateSSBO, 0, sizeof(SimState), &state);
+    float activeFraction = state.liveCount > 0 ? (float)state.activeCount / state.liveCount : 0.0f;
+
+    std::cout << "Sleeping particles: " << state.activeCount << " of " << state.liveCount << " active (" << 100.0f * activeFraction << "%), "
+              << stepTime << " ms per step";
+    if(awakeStepTime > 0.0 && stepTime > 0.0) std::cout << ", " << awakeStepTime / stepTime << "x faster than all awake (" << awakeStepTime << " ms)";
+    std::cout << std::endl;
+
+    stepTimer.reset();
+}
+
+void SPH::sortCells(){
+    TRACE_ZONE("SPH::sortCells");
+    glUseProgram(sortCellsProgram);
+    glUniform1ui(glGetUniformLocation(sortCellsProgram, "cellCount"), gridSize);
+
+    if(!sleeping) sortTimer.begin();
+    glDispatchCompute((gridSize + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if(!sleeping) sortTimer.end();
+}
+
+void SPH::reportDeterministic(){
+    //The fast mode runs the same passes minus the sort, so the sort's share is the price of repeatability
+    double sortTime = sortTimer.getAverage();
+    double passTime = passTimer.getAverage();
+    if(passTime <= 0.0) return;
+
+    std::cout << "Deterministic neighbor order: sorting cells takes " << sortTime << " ms per substep against " << passTime
+              << " ms for the density, force and integration passes (+" << 100.0 * sortTime / passTime << "% over the fast mode)" << std::endl;
+
+    sortTimer.reset();
+    passTimer.reset();
+}
+
+void SPH::gatherGridStats(){
+    TRACE_ZONE("SPH::gatherGridStats");
+    //The oldest readback is reused, a sample is skipped rather than waiting for the GPU to finish it
+    StatsReadback& readback = statsReadback[nextStatsReadback];
+    if(readback.fence){
+        collectGridStats();
+        if(readback.fence) return;
+    }
+
+    glClearNamedBufferData(statsSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, statsSSBO);
+
+    glUseProgram(statsProgram);
+    setPassUniforms(statsProgram);
+    glUniform1ui(glGetUniformLocation(statsProgram, "cellCount"), gridSize);
+    glUniform1ui(glGetUniformLocation(statsProgram, "stage"), 0);
+    glDispatchComputeIndirect(particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUniform1ui(glGetUniformLocation(statsProgram, "stage"), 1);
+    glDispatchCompute((gridSize + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glCopyNamedBufferSubData(statsSSBO, readback.buffer, 0, 0, sizeof(GridStats));
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.step = statsStep;
+    nextStatsReadback = (nextStatsReadback + 1) % statsReadbacks;
+}
+
+void SPH::collectGridStats(){
+    //Oldest first, stopping at the first copy the GPU has not reached yet
+    for(int i = 0; i < statsReadbacks; i++){
+        StatsReadback& readback = statsReadback[(nextStatsReadback + i) % statsReadbacks];
+        if(!readback.fence) continue;
+
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED) break;
+        if(status == GL_WAIT_FAILED) throw std::runtime_error("Waiting for the grid statistics failed");
+
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        glGetNamedBufferSubData(readback.buffer, 0, sizeof(GridStats), &gridStats);
+        gridStatsStep = readback.step;
+        reportGridStats();
+    }
+}
+
+void SPH::reportGridStats(){
+    const GridStats& stats = gridStats;
+    uint64_t visited = stats.visitedPairs[0] | (uint64_t)stats.visitedPairs[1] << 32;
+    uint64_t neighbors = stats.neighborPairs[0] | (uint64_t)stats.neighborPairs[1] << 32;
+    double particles = std::max<double>(stats.sampledParticles, 1.0);
+    double meanNeighbors = neighbors / particles;
+    double wastedFraction = visited > 0 ? 1.0 - (double)neighbors / visited : 0.0;
+
+    //Ghosts sit in the cells too, so the occupancy comes from the histogram, the last bin counting as its lower bound
+    double cellParticles = 0.0;
+    for(int b = 1; b < GridStats::bins; b++) cellParticles += (double)b * stats.occupancyHistogram[b];
+    double perOccupiedCell = stats.occupiedCells > 0 ? cellParticles / stats.occupiedCells : 0.0;
+
+    std::cout << "Grid statistics at step " << gridStatsStep << ": " << meanNeighbors << " neighbors per particle within h (max "
+              << stats.maxNeighbors << "), " << visited / particles << " pairs visited of which " << 100.0 * wastedFraction
+              << "% lie outside h, " << stats.occupiedCells << " of " << gridSize << " cells occupied ("
+              << 100.0 * stats.occupiedCells / std::max<size_t>(gridSize, 1) << "%) with " << perOccupiedCell
+              << " particles on average (max " << stats.maxCellLength << ")" << std::endl;
+
+    std::cout << "  neighbors:";
+    for(int b = 0; b < GridStats::bins; b++){
+        if(stats.neighborHistogram[b] == 0) continue;
+        int low = b * GridStats::neighborBinWidth;
+        if(b == GridStats::bins - 1) std::cout << " " << low << "+:";
+        else std::cout << " " << low << "-" << low + GridStats::neighborBinWidth - 1 << ":";
+        std::cout << stats.neighborHistogram[b];
+    }
+    std::cout << std::endl << "  particles per occupied cell:";
+    for(int b = 1; b < GridStats::bins; b++){
+        if(stats.occupancyHistogram[b] == 0) continue;
+        std::cout << " " << b << (b == GridStats::bins - 1 ? "+:" : ":") << stats.occupancyHistogram[b];
+    }
+    std::cout << std::endl;
+
+    Trace::recordCounter("neighbors per particle", meanNeighbors);
+    Trace::recordCounter("max neighbors", stats.maxNeighbors);
+    Trace::recordCounter("wasted pair fraction", wastedFraction);
+    Trace::recordCounter("occupied cells", stats.occupiedCells);
+    Trace::recordCounter("max cell length", stats.maxCellLength);
+}
+
+void SPH::removeAndEmitParticles(float dt){
+    TRACE_ZONE("SPH::removeAndEmitParticles");
+    if(!sinks.empty() || adaptiveResolution) compactParticles();
+    if(adaptiveResolution) splitParticles();
+    if(!emitters.empty()) emitParticles(dt);
+
+    //Scratch bindings overlap the renderer's, restore the solver's view of them
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, hotSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, warmSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, coldSSBO);
+}
+
+void SPH::compactParticles(){
+    //Flag the survivors
+    std::vector<glm::vec4> planes, boxMin, boxMax;
+    for(const Sink& sink : sinks){
+        if(sink.type == SINK_PLANE){
+            planes.push_back(sink.a);
+        }else{
+            boxMin.push_back(sink.a);
+            boxMax.push_back(sink.b);
+        }
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, aliveFlagSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, aliveOffsetSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, blockSumSSBO);
+
+    glUseProgram(sinkProgram);
+    glUniform1i(glGetUniformLocation(sinkProgram, "sinkPlaneCount"), planes.size());
+    glUniform1i(glGetUniformLocation(sinkProgram, "sinkBoxCount"), boxMin.size());
+    for(size_t i = 0; i < planes.size(); i++){
+        glUniform4fv(glGetUniformLocation(sinkProgram, ("sinkPlanes[" + std::to_string(i) + "]").c_str()), 1, &planes[i][0]);
+    }
+    for(size_t i = 0; i < boxMin.size(); i++){
+        glUniform3fv(glGetUniformLocation(sinkProgram, ("sinkBoxMin[" + std::to_string(i) + "]").c_str()), 1, &boxMin[i][0]);
+        glUniform3fv(glGetUniformLocation(sinkProgram, ("sinkBoxMax[" + std::to_string(i) + "]").c_str()), 1, &boxMax[i][0]);
+    }
+    glDispatchComputeIndirect(particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //Merged away particles leave through the same compaction as sunk ones
+    if(adaptiveResolution) mergeParticles();
+
+    //Exclusive scan of the flags gives every survivor its new slot
+    glUseProgram(scanProgram);
+    for(GLuint stage = 0; stage < 3; stage++){
+        glUniform1ui(glGetUniformLocation(scanProgram, "stage"), stage);
+        if(stage == 1) glDispatchCompute(1, 1, 1);
+        else glDispatchComputeIndirect(offsetof(SimState, scanDispatch));
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    //Scatter into the scratch streams, then copy back only the survivors once the live count shrank to them
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, hotScratchSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, warmScratchSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, coldScratchSSBO);
+
+    glUseProgram(compactProgram);
+    glUniform1ui(glGetUniformLocation(compactProgram, "stage"), 0);
+    glDispatchComputeIndirect(particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    updateState(0, 0);
+
+    glUseProgram(compactProgram);
+    glUniform1ui(glGetUniformLocation(compactProgram, "stage"), 1);
+    glDispatchComputeIndirect(particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void SPH::mergeParticles(){
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, mergePartnerSSBO);
+
+    glUseProgram(adaptProgram);
+    setPassUniforms(adaptProgram);
+    for(GLuint stage = 0; stage < 2; stage++){
+        glUniform1ui(glGetUniformLocation(adaptProgram, "stage"), stage);
+        glDispatchComputeIndirect(particleDispatchOffset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+}
+
+void SPH::splitParticles(){
+    //Children are appended behind the live particles, the count is folded in on the GPU
+    glUseProgram(adaptProgram);
+    setPassUniforms(adaptProgram);
+    glUniform1ui(glGetUniformLocation(adaptProgram, "stage"), 2);
+    glUniform1ui(glGetUniformLocation(adaptProgram, "particleCapacity"), _particleCapacity);
+    glUniform1ui(glGetUniformLocation(adaptProgram, "seed"), emitSeed++);
+    glDispatchComputeIndirect(particleDispatchOffset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    updateState(3, 0);
+}
+
+void SPH::reportAdaptiveResolution(){
+    //Full readback, only done every reportInterval frames to check that splitting and merging conserve mass and momentum
+    std::vector<particle> current;
+    readParticles(current);
+
+    int levels[4] = {0, 0, 0, 0};
+    float totalMass = 0.0f;
+    glm::vec3 momentum(0.0f);
+    for(const particle& p : current){
+        int level = (int)std::round(std::log2(params.mass / p.velocity.w));
+        levels[std::min(std::max(level, 0), 3)]++;
+        totalMass += p.velocity.w;
+        momentum += p.velocity.w * glm::vec3(p.velocity);
+    }
+
+    std::cout << "Adaptive resolution: " << current.size() << " particles (full " << levels[0] << ", 1/2 " << levels[1]
+              << ", 1/4 " << levels[2] << ", 1/8 " << levels[3] << "), mass " << totalMass
+              << " (" << totalMass / params.mass << " base particles), momentum (" << momentum.x << ", " << momentum.y << ", " << momentum.z << ")" << std::endl;
+}
+
+void SPH::emitParticles(float dt){
+    //Whole particles per emitter are decided on the CPU, where they land is decided on the GPU
+    GLuint appended = 0;
+
+    glUseProgram(emitProgram);
+    glUniform1ui(glGetUniformLocation(emitProgram, "particleCapacity"), _particleCapacity);
+
+    for(Emitter& emitter : emitters){
+        emitter.accumulated += emitter.rate * dt;
+        GLuint count = (GLuint)emitter.accumulated;
+        emitter.accumulated -= count;
+        if(count == 0) continue;
+
+        glUniform3fv(glGetUniformLocation(emitProgram, "emitterPosition"), 1, &emitter.position[0]);
+        glUniform3fv(glGetUniformLocation(emitProgram, "emitterVelocity"), 1, &emitter.velocity[0]);
+        glUniform1f(glGetUniformLocation(emitProgram, "emitterRadius"), emitter.radius);
+        glUniform1ui(glGetUniformLocation(emitProgram, "emitCount"), count);
+        glUniform1ui(glGetUniformLocation(emitProgram, "emitOffset"), appended);
+        glUniform1ui(glGetUniformLocation(emitProgram, "seed"), emitSeed++);
+        glDispatchCompute((count + 255) / 256, 1, 1);
+
+        appended += count;
+    }
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if(appended > 0) updateState(1, appended);
+}
+
+void SPH::updateState(GLuint mode, GLuint appendCount){
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, blockSumSSBO);
+    glUseProgram(updateStateProgram);
+    glUniform1ui(glGetUniformLocation(updateStateProgram, "mode"), mode);
+    glUniform1ui(glGetUniformLocation(updateStateProgram, "appendCount"), appendCount);
+    glUniform1ui(glGetUniformLocation(updateStateProgram, "particleCapacity"), _particleCapacity);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 }
 
 void SPH::cleanup(){
-    glDeleteBuffers(1, &particleSSBO);
+    if(mappedStreams){
+        glUnmapNamedBuffer(hotSSBO);
+        glUnmapNamedBuffer(warmSSBO);
+        glUnmapNamedBuffer(coldSSBO);
+    }
+
+    glDeleteBuffers(1, &hotSSBO);
+    glDeleteBuffers(1, &warmSSBO);
+    glDeleteBuffers(1, &coldSSBO);
+    glDeleteBuffers(1, &accelerationSSBO);
     glDeleteBuffers(1, &gridSSBO);
     glDeleteBuffers(1, &listSSBO);
-    glDeleteProgram(updateProgram);
+    glDeleteBuffers(1, &paramsUBO);
+    glDeleteProgram(insertProgram);
+    glDeleteProgram(densityProgram);
+    glDeleteProgram(forceProgram);
+    glDeleteProgram(integrateProgram);
+    glDeleteTextures(1, &boundaryTexture);
+    if(boundaryParticles){
+        glDeleteBuffers(1, &boundaryCellSSBO);
+        glDeleteBuffers(1, &boundaryParticleSSBO);
+    }
+
+    glDeleteBuffers(1, &stateSSBO);
+    glDeleteBuffers(1, &aliveFlagSSBO);
+    glDeleteBuffers(1, &aliveOffsetSSBO);
+    glDeleteBuffers(1, &blockSumSSBO);
+    glDeleteBuffers(1, &hotScratchSSBO);
+    glDeleteBuffers(1, &warmScratchSSBO);
+    glDeleteBuffers(1, &coldScratchSSBO);
+    glDeleteProgram(sinkProgram);
+    glDeleteProgram(scanProgram);
+    glDeleteProgram(compactProgram);
+    glDeleteProgram(emitProgram);
+    glDeleteProgram(updateStateProgram);
+
+    if(sleeping){
+        glDeleteBuffers(1, &cellSleepSSBO);
+        glDeleteBuffers(1, &activeListSSBO);
+        glDeleteProgram(sleepProgram);
+        stepTimer.cleanup();
+    }
+
+    if(adaptiveResolution){
+        glDeleteBuffers(1, &mergePartnerSSBO);
+        glDeleteProgram(adaptProgram);
+    }
+
+    if(!ensemble.empty()){
+        glDeleteBuffers(1, &sceneSSBO);
+    }
+
+    if(deterministic){
+        glDeleteProgram(sortCellsProgram);
+        sortTimer.cleanup();
+        passTimer.cleanup();
+    }
+
+    if(statsInterval > 0){
+        glDeleteBuffers(1, &statsSSBO);
+        glDeleteProgram(statsProgram);
+        for(StatsReadback& readback : statsReadback){
+            if(readback.fence) glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+            glDeleteBuffers(1, &readback.buffer);
+        }
+    }
+
+    if(!stageQueries.empty()) glDeleteQueries(stageQueries.size(), stageQueries.data());
+    stageQueries.clear();
 }
 
 GLuint SPH::getBufferId(){
-    return particleSSBO;
+    return hotSSBO;
 }
 
 int SPH::getParticleCount(){
-    return _particleCount;
+    GLuint liveCount;
+    glGetNamedBufferSubData(stateSSBO, offsetof(SimState, liveCount), sizeof(GLuint), &liveCount);
+    return liveCount;
+}
+
+int SPH::getParticleCapacity(){
+    return _particleCapacity;
+}
+
+GLuint SPH::getStateBufferId(){
+    return stateSSBO;
 }
 
 size_t SPH::getParticleSize(){
-    return sizeof(particle);
+    return compactStorage ? sizeof(glm::uvec2) : sizeof(glm::vec4);
+}
+
+size_t SPH::getWarmSize(){
+    return compactStorage ? sizeof(glm::uvec2) : sizeof(glm::vec4);
+}
+
+void SPH::readParticles(std::vector<particle>& out){
+    readParticleRange(out, 0, getParticleCount(), params);
+}
+
+void SPH::readScene(int scene, std::vector<particle>& out){
+    if(ensemble.empty()) readParticles(out);
+    else readParticleRange(out, sceneOffsets[scene], sceneOffsets[scene + 1] - sceneOffsets[scene], ensemble[scene]);
+}
+
+void SPH::readParticleRange(std::vector<particle>& out, int first, int count, const SimParams& scene){
+    TRACE_ZONE("SPH::readParticles");
+    out.resize(count);
+
+    std::vector<char> hot(count * getParticleSize());
+    std::vector<char> warm(count * getWarmSize());
+    std::vector<glm::vec4> cold(count);
+
+    glGetNamedBufferSubData(hotSSBO, first * getParticleSize(), hot.size(), hot.data());
+    glGetNamedBufferSubData(warmSSBO, first * getWarmSize(), warm.size(), warm.data());
+    glGetNamedBufferSubData(coldSSBO, first * sizeof(glm::vec4), cold.size() * sizeof(glm::vec4), cold.data());
+
+    for(int i = 0; i < count; i++){
+        particle& p = out[i];
+        if(compactStorage){
+            unpackHot(reinterpret_cast<const glm::uvec2*>(hot.data())[i], p);
+            unpackWarm(reinterpret_cast<const glm::uvec2*>(warm.data())[i], p);
+        }else{
+            glm::vec4 position = reinterpret_cast<const glm::vec4*>(hot.data())[i];
+            p.position = glm::vec4(glm::vec3(position), 0.0f);
+            p.velocity = reinterpret_cast<const glm::vec4*>(warm.data())[i];
+            p.properties.x = position.w;
+        }
+        p.properties = glm::vec4(p.properties.x, pressureFromDensity(p.properties.x, scene), cold[i].x, cold[i].y);
+    }
+}
+
+void SPH::writeParticles(const std::vector<particle>& in, int ownedCount){
+    TRACE_ZONE("SPH::writeParticles");
+    int liveCount = in.size();
+    if(liveCount > _particleCapacity) throw std::runtime_error("Particle count " + std::to_string(liveCount) + " exceeds the capacity of " + std::to_string(_particleCapacity));
+    this->ownedCount = ownedCount;
+
+    std::vector<glm::vec4> cold(liveCount);
+    for(int i = 0; i < liveCount; i++){
+        cold[i] = glm::vec4(in[i].properties.z, in[i].properties.w, 0.0f, 0.0f);
+    }
+    tagScenes(cold);
+
+    if(compactStorage){
+        std::vector<glm::uvec2> hot(liveCount), warm(liveCount);
+        for(int i = 0; i < liveCount; i++){
+            hot[i] = packHot(in[i]);
+            warm[i] = packWarm(in[i]);
+        }
+        glNamedBufferSubData(hotSSBO, 0, hot.size() * sizeof(glm::uvec2), hot.data());
+        glNamedBufferSubData(warmSSBO, 0, warm.size() * sizeof(glm::uvec2), warm.data());
+    }else{
+        std::vector<glm::vec4> hot(liveCount), warm(liveCount);
+        for(int i = 0; i < liveCount; i++){
+            hot[i] = glm::vec4(glm::vec3(in[i].position), in[i].properties.x);
+            warm[i] = in[i].velocity;
+        }
+        glNamedBufferSubData(hotSSBO, 0, hot.size() * sizeof(glm::vec4), hot.data());
+        glNamedBufferSubData(warmSSBO, 0, warm.size() * sizeof(glm::vec4), warm.data());
+    }
+    glNamedBufferSubData(coldSSBO, 0, cold.size() * sizeof(glm::vec4), cold.data());
+
+    //Everyone is dispatched so ghosts get their densities, only owned particles are drawn
+    SimState state = {};
+    glGetNamedBufferSubData(stateSSBO, 0, sizeof(SimState), &state);
+    state.liveCount = liveCount;
+    state.particleDispatch[0] = (liveCount + 255) / 256;
+    state.particleDraw[0] = ownedCount;
+    state.scanDispatch[0] = (liveCount + 1023) / 1024;
+    state.activeDispatch[0] = state.particleDispatch[0];
+    state.activeCount = liveCount;
+    glNamedBufferSubData(stateSSBO, 0, sizeof(SimState), &state);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+int SPH::getOwnedCount(){
+    return ownedCount;
+}
+
+const std::vector<particle>& SPH::getInitialParticles(){
+    return particles;
 }
 
 void SPH::compileAndLoadShaders(){
-    updateProgram = buildShaderFromSource("../shaders/sph.comp");
+    TRACE_ZONE("SPH::compileAndLoadShaders");
+    insertProgram = buildShaderFromSource(shaderDirectory + "sph_insert.comp");
+    densityProgram = buildShaderFromSource(shaderDirectory + "sph_density.comp");
+    forceProgram = buildShaderFromSource(shaderDirectory + "sph_force.comp");
+    integrateProgram = buildShaderFromSource(shaderDirectory + "sph_integrate.comp");
+
+    sinkProgram = buildShaderFromSource(shaderDirectory + "sph_sink.comp");
+    scanProgram = buildShaderFromSource(shaderDirectory + "scan.comp", {"SCAN_BINDING_BASE 6", "SCAN_LIVE_COUNT"});
+    compactProgram = buildShaderFromSource(shaderDirectory + "sph_compact.comp");
+    emitProgram = buildShaderFromSource(shaderDirectory + "sph_emit.comp");
+    updateStateProgram = buildShaderFromSource(shaderDirectory + "sph_update_state.comp");
+    if(sleeping) sleepProgram = buildShaderFromSource(shaderDirectory + "sph_sleep.comp");
+    if(adaptiveResolution) adaptProgram = buildShaderFromSource(shaderDirectory + "sph_adapt.comp");
+    if(deterministic) sortCellsProgram = buildShaderFromSource(shaderDirectory + "sph_sort_cells.comp");
+    if(statsInterval > 0) statsProgram = buildShaderFromSource(shaderDirectory + "sph_stats.comp");
 }
 
-GLuint SPH::buildShaderFromSource(const std::string& filenameComp){
+GLuint SPH::buildShaderFromSource(const std::string& filenameComp, const std::vector<std::string>& extraDefines){
+    TRACE_ZONE("SPH::buildShaderFromSource");
     //Load compute shader from file and compile via OpenGL
-    std::vector<char> compFile = readFile(filenameComp);
-    compFile.push_back('\0');
-    const GLchar* computeShaderSource = compFile.data();
+    std::vector<std::string> defines = getShaderDefines();
+    defines.insert(defines.end(), extraDefines.begin(), extraDefines.end());
+    std::string compFile = ShaderLoader::loadSource(filenameComp, defines);
+    const GLchar* computeShaderSource = compFile.c_str();
 
     GLuint computeShader;
     computeShader = glCreateShader(GL_COMPUTE_SHADER);
@@ -131,25 +1300,56 @@ GLuint SPH::buildShaderFromSource(const std::string& filenameComp){
     return shaderProgram;
 }
 
-std::vector<char> SPH::readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+void SPH::initializeFirstLoop(){
+    currentTime = std::chrono::high_resolution_clock::now();
+    firstLoop = false;
+}
+
+void SPH::reportStorageError(){
+    //Quantization of the initial state, velocities and densities keep 11 significant bits as fp16
+    float positionStep = (domainMax - domainMin) / 65535.0f;
+    float maxPositionError = 0.0f;
+
+    for(const particle& p : particles){
+        particle roundTrip;
+        unpackHot(packHot(p), roundTrip);
+        maxPositionError = std::max(maxPositionError, glm::length(glm::vec3(roundTrip.position - p.position)));
+    }
+
+    std::cout << "Compact particle storage: hot and warm streams take " << sizeof(glm::uvec2) << " bytes per particle each instead of " << sizeof(glm::vec4) << "\n"
+              << "  neighbor fetches: 8 bytes in the density loop, 16 in the force loop (full: 16 and 32)\n"
+              << "  position step " << positionStep << " (" << positionStep / params.h << " h), max round trip error " << maxPositionError << "\n"
+              << "  velocity and density relative error <= " << 1.0f / 2048.0f << std::endl;
+}
+
+float SPH::pressureFromDensity(float density, const SimParams& scene){
+    return std::max(0.0001f, scene.stiffness * (density - scene.restDensity));
+}
 
-	if (!file.is_open()) {
-		throw std::runtime_error("Failed to open file!");
-	}
+glm::uvec2 SPH::packHot(const particle& p){
+    glm::vec3 normalized = glm::clamp((glm::vec3(p.position) - domainMin) / (domainMax - domainMin), 0.0f, 1.0f);
 
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
+    glm::uvec2 packed;
+    packed.x = glm::packUnorm2x16(glm::vec2(normalized.x, normalized.y));
+    packed.y = (glm::packUnorm2x16(glm::vec2(normalized.z, 0.0f)) & 0xffffu) | (glm::packHalf2x16(glm::vec2(0.0f, p.properties.x)) & 0xffff0000u);
+    return packed;
+}
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
+glm::uvec2 SPH::packWarm(const particle& p){
+    return glm::uvec2(glm::packHalf2x16(glm::vec2(p.velocity.x, p.velocity.y)), glm::packHalf2x16(glm::vec2(p.velocity.z, p.velocity.w)));
+}
 
-	file.close();
+void SPH::unpackHot(const glm::uvec2& packed, particle& p){
+    glm::vec2 xy = glm::unpackUnorm2x16(packed.x);
+    glm::vec2 z = glm::unpackUnorm2x16(packed.y);
 
-	return buffer;
+    p.position = glm::vec4(domainMin + glm::vec3(xy.x, xy.y, z.x) * (domainMax - domainMin), 0.0f);
+    p.properties.x = glm::unpackHalf2x16(packed.y).y;
 }
 
-void SPH::initializeFirstLoop(){
-    currentTime = std::chrono::high_resolution_clock::now();
-    firstLoop = false;
-}
\ No newline at end of file
+void SPH::unpackWarm(const glm::uvec2& packed, particle& p){
+    glm::vec2 xy = glm::unpackHalf2x16(packed.x);
+    glm::vec2 z = glm::unpackHalf2x16(packed.y);
+
+    p.velocity = glm::vec4(xy.x, xy.y, z.x, z.y);
+}
@@ -0,0 +1,305 @@
+#include "SurfaceExtractor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unordered_set>
+
+#include "MarchingCubesTables.h"
+
+void SurfaceExtractor::init(ThreadPool* threadPool, float cellSize, float kernelRadius, float isoLevel, float baseMass){
+    _threadPool = threadPool;
+    _cellSize = cellSize;
+    _kernelRadius = kernelRadius;
+    _isoLevel = isoLevel;
+    _baseMass = baseMass;
+
+    //Re-initialized when the parameters change, cached blocks may have a different size now
+    blocks.clear();
+
+    //Splatting only looks at the 26 neighboring blocks, so a kernel may not reach further than one block
+    if(kernelRadius > blockCells * cellSize){
+        throw std::runtime_error("Surface kernel radius must not exceed the block size");
+    }
+}
+
+void SurfaceExtractor::extract(const std::vector<particle>& particles){
+    TRACE_ZONE("SurfaceExtractor::extract");
+    //Bin particles into the blocks that contain them
+    for(auto& bin : blockParticles) bin.second.clear();
+
+    for(uint32_t i = 0; i < particles.size(); i++){
+        blockParticles[packBlockKey(getBlockIndex(glm::vec3(particles[i].position)))].push_back(i);
+    }
+
+    //Every block next to an occupied block can hold a piece of the surface
+    std::unordered_set<uint64_t> activeKeys;
+    for(auto& bin : blockParticles){
+        if(bin.second.empty()) continue;
+
+        glm::ivec3 blockIndex = unpackBlockKey(bin.first);
+        for(int z = -1; z <= 1; z++)
+            for(int y = -1; y <= 1; y++)
+                for(int x = -1; x <= 1; x++)
+                    activeKeys.insert(packBlockKey(blockIndex + glm::ivec3(x, y, z)));
+    }
+
+    //Drop blocks the fluid has left, keep the others and their cached triangles
+    for(auto it = blocks.begin(); it != blocks.end();){
+        if(activeKeys.count(it->first) == 0) it = blocks.erase(it);
+        else ++it;
+    }
+
+    //Sorted keys run along z, then y, then x, so each thread's range of blocks is one spatial slab
+    std::vector<uint64_t> keys(activeKeys.begin(), activeKeys.end());
+    std::sort(keys.begin(), keys.end());
+    std::vector<Block*> activeBlocks(keys.size());
+    for(size_t i = 0; i < keys.size(); i++){
+        activeBlocks[i] = &blocks[keys[i]];
+    }
+
+    //Fluid pools at the bottom, so blocks differ wildly in cost, which is about the particles splatted into them
+    std::vector<uint32_t> costs(keys.size(), 0);
+    for(size_t i = 0; i < keys.size(); i++){
+        glm::ivec3 blockIndex = unpackBlockKey(keys[i]);
+        for(int z = -1; z <= 1; z++)
+        for(int y = -1; y <= 1; y++)
+        for(int x = -1; x <= 1; x++){
+            auto bin = blockParticles.find(packBlockKey(blockIndex + glm::ivec3(x, y, z)));
+            if(bin != blockParticles.end()) costs[i] += bin->second.size();
+        }
+    }
+
+    //Copy each block's particles next to its densities, splatting then reads neighbors from the same slab
+    forEachBlock(costs, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            Block& block = *activeBlocks[i];
+            block.points.clear();
+
+            auto bin = blockParticles.find(keys[i]);
+            if(bin == blockParticles.end()) continue;
+
+            for(uint32_t p : bin->second){
+                //Split particles contribute their share of the base mass
+                block.points.push_back(glm::vec4(glm::vec3(particles[p].position), particles[p].velocity.w / _baseMass));
+            }
+        }
+    });
+
+    //Splat and re-mesh blocks in parallel, blocks whose densities did not change reuse their triangles
+    std::atomic<size_t> reused(0);
+
+    forEachBlock(costs, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            Block& block = *activeBlocks[i];
+            splatBlock(keys[i], block);
+
+            uint64_t hash = hashBlock(block);
+            if(block.meshed && hash == block.densityHash){
+                reused++;
+                continue;
+            }
+
+            polygonizeBlock(keys[i], block);
+            block.densityHash = hash;
+            block.meshed = true;
+        }
+    });
+
+    reusedBlocks = reused;
+
+    //Gather the per block triangles into one mesh
+    std::vector<size_t> offsets(activeBlocks.size() + 1, 0);
+    for(size_t i = 0; i < activeBlocks.size(); i++){
+        offsets[i + 1] = offsets[i] + activeBlocks[i]->triangles.size();
+    }
+
+    mesh.vertices.resize(offsets.back());
+    _threadPool->parallelFor(activeBlocks.size(), [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            std::copy(activeBlocks[i]->triangles.begin(), activeBlocks[i]->triangles.end(), mesh.vertices.begin() + offsets[i]);
+        }
+    });
+    mesh.version++;
+}
+
+void SurfaceExtractor::exportPLY(const std::string& filename){
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    size_t vertexCount = mesh.vertices.size();
+    size_t faceCount = vertexCount / 3;
+
+    file << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "element vertex " << vertexCount << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "element face " << faceCount << "\n"
+         << "property list uchar int vertex_indices\n"
+         << "end_header\n";
+
+    file.write(reinterpret_cast<const char*>(mesh.vertices.data()), vertexCount * sizeof(MeshVertex));
+
+    //Faces are consecutive vertex triples, so they can be written in one go
+    std::vector<char> faces(faceCount * 13);
+    for(size_t i = 0; i < faceCount; i++){
+        int32_t indices[3] = {(int32_t)(3 * i), (int32_t)(3 * i + 1), (int32_t)(3 * i + 2)};
+        faces[i * 13] = 3;
+        std::memcpy(&faces[i * 13 + 1], indices, sizeof(indices));
+    }
+    file.write(faces.data(), faces.size());
+
+    file.close();
+}
+
+void SurfaceExtractor::cleanup(){
+    blocks.clear();
+    blockParticles.clear();
+    mesh.vertices.clear();
+}
+
+const SurfaceMesh& SurfaceExtractor::getMesh(){
+    return mesh;
+}
+
+size_t SurfaceExtractor::getBlockCount(){
+    return blocks.size();
+}
+
+size_t SurfaceExtractor::getReusedBlockCount(){
+    return reusedBlocks;
+}
+
+uint64_t SurfaceExtractor::packBlockKey(const glm::ivec3& blockIndex){
+    //21 bits per axis, offset so negative block indices stay positive
+    const int64_t offset = 1 << 20;
+    return  (uint64_t)(blockIndex.x + offset) |
+           ((uint64_t)(blockIndex.y + offset) << 21) |
+           ((uint64_t)(blockIndex.z + offset) << 42);
+}
+
+glm::ivec3 SurfaceExtractor::unpackBlockKey(uint64_t key){
+    const int64_t offset = 1 << 20;
+    const uint64_t mask = (1 << 21) - 1;
+    return glm::ivec3((int)((int64_t)(key & mask) - offset),
+                      (int)((int64_t)((key >> 21) & mask) - offset),
+                      (int)((int64_t)((key >> 42) & mask) - offset));
+}
+
+glm::ivec3 SurfaceExtractor::getBlockIndex(const glm::vec3& position){
+    return glm::ivec3(glm::floor(position / (blockCells * _cellSize)));
+}
+
+void SurfaceExtractor::forEachBlock(const std::vector<uint32_t>& costs, const std::function<void(size_t, size_t)>& task){
+    //Pinned threads keep the same slab of blocks every frame, so block memory stays on their node, otherwise chunks are balanced by cost and stolen
+    if(_threadPool->isPinned()) _threadPool->parallelForPinned(costs.size(), task);
+    else _threadPool->parallelForWeighted(costs, task);
+}
+
+void SurfaceExtractor::splatBlock(uint64_t key, Block& block){
+    glm::ivec3 blockIndex = unpackBlockKey(key);
+    glm::vec3 origin = glm::vec3(blockIndex * blockCells) * _cellSize;
+
+    block.density.assign(sampleCount * sampleCount * sampleCount, 0.0f);
+
+    float radius = _kernelRadius / _cellSize;
+    float radius2 = radius * radius;
+
+    for(int z = -1; z <= 1; z++)
+    for(int y = -1; y <= 1; y++)
+    for(int x = -1; x <= 1; x++){
+        auto neighbor = blocks.find(packBlockKey(blockIndex + glm::ivec3(x, y, z)));
+        if(neighbor == blocks.end()) continue;
+
+        for(const glm::vec4& point : neighbor->second.points){
+            //Particle position in sample space, sample 0 is the apron node in front of the block
+            glm::vec3 local = (glm::vec3(point) - origin) / _cellSize + 1.0f;
+            float weight = point.w;
+
+            glm::ivec3 lo = glm::max(glm::ivec3(glm::ceil(local - radius)), glm::ivec3(0));
+            glm::ivec3 hi = glm::min(glm::ivec3(glm::floor(local + radius)), glm::ivec3(sampleCount - 1));
+
+            for(int k = lo.z; k <= hi.z; k++)
+            for(int j = lo.y; j <= hi.y; j++)
+            for(int l = lo.x; l <= hi.x; l++){
+                glm::vec3 d = glm::vec3(l, j, k) - local;
+                float r2 = glm::dot(d, d);
+                if(r2 >= radius2) continue;
+
+                float w = 1.0f - r2 / radius2;
+                block.density[l + sampleCount * (j + sampleCount * k)] += w * w * w * weight;
+            }
+        }
+    }
+}
+
+uint64_t SurfaceExtractor::hashBlock(const Block& block){
+    //FNV-1a over densities quantized to 1/256 of the iso level, so jitter far below the surface resolution still reuses the mesh
+    uint64_t hash = 14695981039346656037ull;
+    for(float density : block.density){
+        uint32_t quantized = (uint32_t)(density / _isoLevel * 256.0f + 0.5f);
+        for(int b = 0; b < 4; b++){
+            hash ^= (quantized >> (8 * b)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+void SurfaceExtractor::polygonizeBlock(uint64_t key, Block& block){
+    glm::vec3 origin = glm::vec3(unpackBlockKey(key) * blockCells) * _cellSize;
+
+    auto sample = [&](int x, int y, int z){
+        return block.density[x + sampleCount * (y + sampleCount * z)];
+    };
+
+    //Density falls off towards the outside, so the outward normal is the negative gradient
+    auto normalAt = [&](int x, int y, int z){
+        return -glm::vec3(sample(x + 1, y, z) - sample(x - 1, y, z),
+                          sample(x, y + 1, z) - sample(x, y - 1, z),
+                          sample(x, y, z + 1) - sample(x, y, z - 1));
+    };
+
+    block.triangles.clear();
+
+    for(int z = 1; z <= blockCells; z++)
+    for(int y = 1; y <= blockCells; y++)
+    for(int x = 1; x <= blockCells; x++){
+        float values[8];
+        int cubeIndex = 0;
+        for(int c = 0; c < 8; c++){
+            values[c] = sample(x + mcCornerOffsets[c][0], y + mcCornerOffsets[c][1], z + mcCornerOffsets[c][2]);
+            if(values[c] >= _isoLevel) cubeIndex |= 1 << c;
+        }
+
+        if(mcEdgeTable[cubeIndex] == 0) continue;
+
+        MeshVertex edgeVertices[12];
+        for(int e = 0; e < 12; e++){
+            if(!(mcEdgeTable[cubeIndex] & (1 << e))) continue;
+
+            const int* c0 = mcCornerOffsets[mcEdgeCorners[e][0]];
+            const int* c1 = mcCornerOffsets[mcEdgeCorners[e][1]];
+            float v0 = values[mcEdgeCorners[e][0]];
+            float v1 = values[mcEdgeCorners[e][1]];
+            float t = (_isoLevel - v0) / (v1 - v0);
+
+            glm::vec3 p0 = glm::vec3(x + c0[0], y + c0[1], z + c0[2]);
+            glm::vec3 p1 = glm::vec3(x + c1[0], y + c1[1], z + c1[2]);
+            glm::vec3 n0 = normalAt(x + c0[0], y + c0[1], z + c0[2]);
+            glm::vec3 n1 = normalAt(x + c1[0], y + c1[1], z + c1[2]);
+            glm::vec3 normal = glm::mix(n0, n1, t);
+
+            edgeVertices[e].position = origin + (glm::mix(p0, p1, t) - 1.0f) * _cellSize;
+            edgeVertices[e].normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+
+        for(int i = 0; mcTriTable[cubeIndex][i] != -1; i++){
+            block.triangles.push_back(edgeVertices[mcTriTable[cubeIndex][i]]);
+        }
+    }
+}
@@ -0,0 +1,383 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+
+void ThreadPool::setPinned(bool pinned){
+    this->pinned = pinned;
+}
+
+void ThreadPool::init(unsigned int threadCount){
+    if(threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    stopping = false;
+    readTopology();
+
+    //Threads take CPUs node by node, so consecutive thread indices and therefore consecutive ranges share a node
+    size_t cpuCount = 0;
+    for(const std::vector<int>& cpus : nodeCpus) cpuCount += cpus.size();
+
+    threadNodes.resize(threadCount);
+    for(unsigned int t = 0; t < threadCount; t++){
+        size_t slot = (size_t)t * cpuCount / threadCount;
+        unsigned int node = 0;
+        while(slot >= nodeCpus[node].size()){
+            slot -= nodeCpus[node].size();
+            node++;
+        }
+        threadNodes[t] = node;
+    }
+
+    //The calling thread also renders, it is kept on its node rather than on one core
+    if(pinned) pinThread(0, true);
+
+    //The calling thread takes part in parallelFor, so spawn one worker less
+    threads.clear();
+    for(unsigned int i = 0; i < threadCount; i++){
+        threads.push_back(std::make_unique<Worker>());
+    }
+    for(unsigned int i = 1; i < threadCount; i++){
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        if(pinned) pinThread(i, false);
+    }
+}
+
+void ThreadPool::cleanup(){
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+
+    for(std::thread& worker : workers){
+        worker.join();
+    }
+    workers.clear();
+    threads.clear();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& task){
+    if(count == 0) return;
+
+    size_t chunkCount = std::min(count, (size_t)getThreadCount() * chunksPerThread);
+    std::vector<size_t> chunkBounds(chunkCount + 1);
+    for(size_t c = 0; c <= chunkCount; c++){
+        chunkBounds[c] = count * c / chunkCount;
+    }
+
+    schedule(chunkBounds, task);
+}
+
+void ThreadPool::parallelForWeighted(const std::vector<uint32_t>& costs, const std::function<void(size_t, size_t)>& task){
+    size_t count = costs.size();
+    if(count == 0) return;
+
+    //Every item costs at least one, so runs of empty items still get split
+    uint64_t totalCost = count;
+    for(uint32_t cost : costs) totalCost += cost;
+
+    size_t chunkCount = std::min(count, (size_t)getThreadCount() * chunksPerThread);
+    uint64_t chunkCost = (totalCost + chunkCount - 1) / chunkCount;
+
+    std::vector<size_t> chunkBounds = {0};
+    uint64_t accumulated = 0;
+    for(size_t i = 0; i < count; i++){
+        accumulated += costs[i] + 1;
+        if(accumulated >= chunkCost){
+            chunkBounds.push_back(i + 1);
+            accumulated = 0;
+        }
+    }
+    if(chunkBounds.back() != count) chunkBounds.push_back(count);
+
+    schedule(chunkBounds, task);
+}
+
+void ThreadPool::schedule(const std::vector<size_t>& chunkBounds, const std::function<void(size_t, size_t)>& task){
+    auto start = std::chrono::steady_clock::now();
+
+    size_t chunkCount = chunkBounds.size() - 1;
+    unsigned int threadCount = getThreadCount();
+
+    size_t remaining = chunkCount;
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+
+    //Neighboring chunks go to the same thread, so a thread works through one contiguous region unless it steals
+    for(unsigned int t = 0; t < threadCount; t++){
+        std::lock_guard<std::mutex> lock(threads[t]->mutex);
+        for(size_t c = chunkCount * t / threadCount; c < chunkCount * (t + 1) / threadCount; c++){
+            size_t begin = chunkBounds[c];
+            size_t end = chunkBounds[c + 1];
+            threads[t]->tasks.push_back([&, begin, end](){
+                task(begin, end);
+
+                std::lock_guard<std::mutex> doneLock(doneMutex);
+                if(--remaining == 0) doneCondition.notify_all();
+            });
+        }
+    }
+    queuedTasks += chunkCount;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+    }
+    queueCondition.notify_all();
+
+    //Help out instead of blocking, then wait for chunks still running on workers
+    while(runPendingTask(0));
+
+    std::unique_lock<std::mutex> doneLock(doneMutex);
+    doneCondition.wait(doneLock, [&](){ return remaining == 0; });
+
+    parallelNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ThreadPool::parallelForPinned(size_t count, const std::function<void(size_t, size_t)>& task){
+    if(count == 0) return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    unsigned int threadCount = getThreadCount();
+    size_t remaining = threadCount - 1;
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for(unsigned int t = 1; t < threadCount; t++){
+            size_t begin = count * t / threadCount;
+            size_t end = count * (t + 1) / threadCount;
+            threads[t]->pinnedTasks.push([&, begin, end](){
+                if(begin < end) task(begin, end);
+
+                std::lock_guard<std::mutex> doneLock(doneMutex);
+                if(--remaining == 0) doneCondition.notify_all();
+            });
+        }
+    }
+    queueCondition.notify_all();
+
+    //No helping here, stealing a range would move its memory to the wrong node
+    size_t end = count / threadCount;
+    if(end > 0) runTimed(0, [&](){ task(0, end); });
+
+    std::unique_lock<std::mutex> doneLock(doneMutex);
+    doneCondition.wait(doneLock, [&](){ return remaining == 0; });
+
+    parallelNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned int ThreadPool::getThreadCount(){
+    return (unsigned int)workers.size() + 1;
+}
+
+bool ThreadPool::isPinned(){
+    return pinned;
+}
+
+unsigned int ThreadPool::getNodeCount(){
+    return nodeCpus.size();
+}
+
+unsigned int ThreadPool::getThreadNode(unsigned int thread){
+    return threadNodes[thread];
+}
+
+void ThreadPool::reportNodeBandwidth(){
+    //256 MiB per node, split among its threads, is well past the last level cache without growing with the core
+    //count, each thread reads only what it touched first
+    const size_t nodeElements = 32 * 1024 * 1024;
+    const int passes = 4;
+    unsigned int threadCount = getThreadCount();
+
+    std::vector<int> nodeThreads(getNodeCount(), 0);
+    for(unsigned int t = 0; t < threadCount; t++) nodeThreads[threadNodes[t]]++;
+
+    std::vector<std::vector<double>> buffers(threadCount);
+    std::vector<double> seconds(threadCount, 0.0);
+    std::vector<double> sums(threadCount, 0.0);
+
+    parallelForPinned(threadCount, [&](size_t begin, size_t end){
+        for(size_t t = begin; t < end; t++){
+            buffers[t].assign(nodeElements / nodeThreads[threadNodes[t]], 1.0);
+        }
+    });
+
+    parallelForPinned(threadCount, [&](size_t begin, size_t end){
+        for(size_t t = begin; t < end; t++){
+            auto start = std::chrono::high_resolution_clock::now();
+            double sum = 0.0;
+            for(int pass = 0; pass < passes; pass++){
+                for(double value : buffers[t]) sum += value;
+            }
+            seconds[t] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            sums[t] = sum;
+        }
+    });
+
+    //Threads of a node run concurrently, so their bandwidths add up
+    std::vector<double> nodeBandwidth(getNodeCount(), 0.0);
+    for(unsigned int t = 0; t < threadCount; t++){
+        size_t elements = buffers[t].size();
+        if(sums[t] != (double)elements * passes || seconds[t] <= 0.0) continue;
+        nodeBandwidth[threadNodes[t]] += elements * passes * sizeof(double) / seconds[t] / 1e9;
+    }
+
+    for(unsigned int node = 0; node < getNodeCount(); node++){
+        std::cout << "NUMA node " << node << ": " << nodeThreads[node] << " threads, "
+                  << std::fixed << std::setprecision(1) << nodeBandwidth[node] << std::defaultfloat << " GB/s local read" << std::endl;
+    }
+}
+
+void ThreadPool::reportUtilization(){
+    double parallelTime = parallelNanoseconds / 1e6;
+    if(parallelTime <= 0.0) return;
+
+    //Idle is time a thread spent inside parallel loops without work, waiting for stragglers or failing to steal
+    double minBusy = 1.0, maxBusy = 0.0, sumBusy = 0.0;
+    uint64_t steals = 0;
+    std::vector<double> busy(threads.size());
+    for(size_t t = 0; t < threads.size(); t++){
+        busy[t] = std::min(1.0, threads[t]->busyNanoseconds / 1e6 / parallelTime);
+        minBusy = std::min(minBusy, busy[t]);
+        maxBusy = std::max(maxBusy, busy[t]);
+        sumBusy += busy[t];
+        steals += threads[t]->steals;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Thread pool: " << parallelTime << " ms in parallel loops, busy min " << 100.0 * minBusy << "% mean " << 100.0 * sumBusy / threads.size()
+              << "% max " << 100.0 * maxBusy << "%, " << steals << " steals\n  busy per thread:";
+    for(size_t t = 0; t < threads.size(); t++){
+        std::cout << " " << t << ":" << 100.0 * busy[t] << "%";
+        threads[t]->busyNanoseconds = 0;
+        threads[t]->steals = 0;
+    }
+    std::cout << std::defaultfloat << std::endl;
+
+    parallelNanoseconds = 0;
+}
+
+void ThreadPool::workerLoop(unsigned int index){
+    TRACE_THREAD_NAME("worker " + std::to_string(index));
+    while(true){
+        std::function<void()> pinnedTask;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [&](){ return stopping || queuedTasks > 0 || !threads[index]->pinnedTasks.empty(); });
+
+            //Pinned work first, the caller of parallelForPinned cannot do it for us
+            if(!threads[index]->pinnedTasks.empty()){
+                pinnedTask = std::move(threads[index]->pinnedTasks.front());
+                threads[index]->pinnedTasks.pop();
+            }else if(stopping && queuedTasks == 0){
+                return;
+            }
+        }
+
+        if(pinnedTask) runTimed(index, pinnedTask);
+        else while(runPendingTask(index));
+    }
+}
+
+bool ThreadPool::runPendingTask(unsigned int index){
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(threads[index]->mutex);
+        if(!threads[index]->tasks.empty()){
+            task = std::move(threads[index]->tasks.back());
+            threads[index]->tasks.pop_back();
+        }
+    }
+
+    //Out of own work, steal the oldest chunk of the next thread that has any
+    for(size_t k = 1; !task && k < threads.size(); k++){
+        Worker& victim = *threads[(index + k) % threads.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            threads[index]->steals++;
+        }
+    }
+
+    if(!task) return false;
+
+    queuedTasks--;
+    runTimed(index, task);
+    return true;
+}
+
+void ThreadPool::runTimed(unsigned int index, const std::function<void()>& task){
+    TRACE_ZONE("ThreadPool::task");
+    auto start = std::chrono::steady_clock::now();
+    task();
+    threads[index]->busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ThreadPool::readTopology(){
+    nodeCpus.clear();
+
+    //Linux lists the CPUs of every memory node, nodes are numbered densely from 0
+    for(int node = 0; ; node++){
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!file.is_open()) break;
+
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus = parseCpuList(list);
+        if(!cpus.empty()) nodeCpus.push_back(cpus);
+    }
+
+    if(nodeCpus.empty()){
+        std::vector<int> cpus;
+        for(unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) cpus.push_back(cpu);
+        nodeCpus.push_back(cpus);
+    }
+}
+
+void ThreadPool::pinThread(unsigned int thread, bool wholeNode){
+    const std::vector<int>& cpus = nodeCpus[threadNodes[thread]];
+
+    //Threads of a node spread over its CPUs in order
+    unsigned int first = 0;
+    while(first < thread && threadNodes[first] != threadNodes[thread]) first++;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(wholeNode){
+        for(int cpu : cpus) CPU_SET(cpu, &set);
+    }else{
+        CPU_SET(cpus[(thread - first) % cpus.size()], &set);
+    }
+
+    pthread_t handle = thread == 0 ? pthread_self() : workers[thread - 1].native_handle();
+    if(pthread_setaffinity_np(handle, sizeof(set), &set) != 0){
+        std::cerr << "Failed to pin thread " << thread << " to node " << threadNodes[thread] << std::endl;
+    }
+}
+
+std::vector<int> ThreadPool::parseCpuList(const std::string& list){
+    //Comma separated CPUs and inclusive ranges, e.g. "0-7,16-23"
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string part;
+
+    while(std::getline(stream, part, ',')){
+        if(part.empty()) continue;
+        size_t dash = part.find('-');
+        int first = std::stoi(part.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(part.substr(dash + 1));
+        for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
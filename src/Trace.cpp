@@ -0,0 +1,116 @@
+#include "Trace.h"
+
+void Trace::start(){
+#ifdef FLUIDSIM_TRACE
+    enabled = true;
+#else
+    throw std::runtime_error("Tracing needs a build with the FLUIDSIM_TRACE option");
+#endif
+}
+
+void Trace::stop(){
+    enabled = false;
+}
+
+void Trace::record(const char* name, int64_t start, int64_t end){
+    append({name, start, end, 0.0, EVENT_ZONE});
+}
+
+void Trace::recordGpu(const char* name, int64_t gpuStart, int64_t gpuEnd){
+    if(!isEnabled()) return;
+
+    int64_t offset = gpuClockOffset.load(std::memory_order_relaxed);
+    append({name, gpuStart + offset, gpuEnd + offset, 0.0, EVENT_GPU});
+}
+
+void Trace::recordCounter(const char* name, double value){
+    if(!isEnabled()) return;
+
+    int64_t time = now();
+    append({name, time, time, value, EVENT_COUNTER});
+}
+
+void Trace::setGpuClockOffset(int64_t offset){
+    gpuClockOffset = offset;
+}
+
+void Trace::setThreadName(const std::string& name){
+    getThreadBuffer()->name = name;
+}
+
+Trace::ThreadBuffer* Trace::getThreadBuffer(){
+    thread_local ThreadBuffer* buffer = nullptr;
+    if(buffer) return buffer;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = buffers.back().get();
+    buffer->id = buffers.size();
+    buffer->name = "thread " + std::to_string(buffer->id);
+    return buffer;
+}
+
+void Trace::append(const Event& event){
+    ThreadBuffer* buffer = getThreadBuffer();
+    size_t index = buffer->count.load(std::memory_order_relaxed);
+    size_t block = index / blockEvents;
+    if(block >= maxBlocks){
+        buffer->dropped++;
+        return;
+    }
+
+    if(!buffer->blocks[block]) buffer->blocks[block].reset(new Event[blockEvents]);
+    buffer->blocks[block][index % blockEvents] = event;
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+void Trace::write(const std::string& filename){
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    //Timestamps start at the first event, GPU spans get a track of their own
+    int64_t origin = INT64_MAX;
+    size_t events = 0;
+    size_t dropped = 0;
+    for(const std::unique_ptr<ThreadBuffer>& buffer : buffers){
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        for(size_t i = 0; i < count; i++) origin = std::min(origin, buffer->blocks[i / blockEvents][i % blockEvents].start);
+        events += count;
+        dropped += buffer->dropped;
+    }
+    const uint32_t gpuTrack = 0;
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+    char line[256];
+    for(const std::unique_ptr<ThreadBuffer>& buffer : buffers){
+        out += ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" + std::to_string(buffer->id) + ",\"args\":{\"name\":\"" + buffer->name + "\"}}";
+
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        for(size_t i = 0; i < count; i++){
+            const Event& event = buffer->blocks[i / blockEvents][i % blockEvents];
+            if(event.kind == EVENT_COUNTER){
+                std::snprintf(line, sizeof(line), ",\n{\"ph\":\"C\",\"name\":\"%s\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                              event.name, (event.start - origin) / 1.0e3, event.value);
+            }else{
+                std::snprintf(line, sizeof(line), ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                              event.name, event.kind == EVENT_GPU ? gpuTrack : buffer->id, (event.start - origin) / 1.0e3, (event.end - event.start) / 1.0e3);
+            }
+            out += line;
+        }
+        file.write(out.data(), out.size());
+        out.clear();
+    }
+    out += "\n]}\n";
+    file.write(out.data(), out.size());
+    file.close();
+
+    std::cout << "Trace: " << events << " events from " << buffers.size() << " threads written to " << filename;
+    if(dropped > 0) std::cout << ", " << dropped << " dropped once the buffers were full";
+    std::cout << std::endl;
+}
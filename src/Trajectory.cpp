@@ -0,0 +1,361 @@
+#include "Trajectory.h"
+
+//Interleaves the top 10 bits of each coordinate, nearby particles end up next to each other in the coded order
+static uint32_t mortonCode(glm::ivec3 quantized, int shift){
+    uint32_t code = 0;
+    for(int bit = 0; bit < 10; bit++){
+        for(int axis = 0; axis < 3; axis++){
+            code |= uint32_t((quantized[axis] >> (shift + bit)) & 1) << (3 * bit + axis);
+        }
+    }
+    return code;
+}
+
+//Chunks of every stream, in stream order
+static size_t chunksPerStream(size_t count, size_t chunkSize){
+    return (count + chunkSize - 1) / chunkSize;
+}
+
+void TrajectoryWriter::init(ThreadPool* threadPool, const std::string& filename, float domainMin, float domainMax, float errorBound, int keyframeInterval){
+    if(!(errorBound > 0.0f && errorBound <= 0.5f)) throw std::runtime_error("Trajectory error bound must lie in (0, 0.5]");
+    if(keyframeInterval < 1) throw std::runtime_error("Keyframe interval must be positive");
+
+    this->threadPool = threadPool;
+    this->filename = filename;
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) throw std::runtime_error("Failed to open " + filename);
+
+    float extent = domainMax - domainMin;
+    header = {magic, version, errorBound, domainMin, domainMax, 2.0f * errorBound * extent, (uint32_t)keyframeInterval, chunkSize};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(header);
+
+    order.clear();
+    previous.clear();
+    frameOffsets.clear();
+    keyframes.clear();
+    rawBytes = 0;
+    encodeSeconds = 0.0;
+}
+
+void TrajectoryWriter::writeFrame(const std::vector<glm::vec3>& positions, float time){
+    TRACE_ZONE("TrajectoryWriter::writeFrame");
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t count = positions.size();
+    bool keyframe = frameOffsets.size() % header.keyframeInterval == 0 || count != previous.size();
+
+    //Quantize, rounding to the nearest step keeps the error within half a step
+    int levels = (int)std::ceil((header.domainMax - header.domainMin) / header.step) + 1;
+    std::vector<glm::ivec3> quantized(count);
+    threadPool->parallelFor(count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            glm::ivec3 q = glm::ivec3(glm::round((positions[i] - header.domainMin) / header.step));
+            quantized[i] = glm::clamp(q, glm::ivec3(0), glm::ivec3(levels - 1));
+        }
+    });
+
+    if(keyframe){
+        int bits = 32 - __builtin_clz((uint32_t)levels);
+        int shift = std::max(0, bits - 10);
+
+        std::vector<std::pair<uint32_t, uint32_t>> codes(count);
+        threadPool->parallelFor(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++) codes[i] = {mortonCode(quantized[i], shift), (uint32_t)i};
+        });
+        std::sort(codes.begin(), codes.end());
+
+        order.resize(count);
+        for(size_t i = 0; i < count; i++) order[i] = codes[i].second;
+    }
+
+    //Keyframes code each position against the one before it in Morton order, other frames against the last frame
+    size_t streamCount = keyframe ? 4 : 3;
+    std::vector<std::vector<uint32_t>> streams(streamCount, std::vector<uint32_t>(count));
+    std::vector<glm::ivec3> coded(count);
+    size_t axisStream = keyframe ? 1 : 0;
+
+    threadPool->parallelFor(count, [&](size_t begin, size_t end){
+        for(size_t k = begin; k < end; k++){
+            coded[k] = quantized[order[k]];
+            glm::ivec3 reference = keyframe ? (k > 0 ? quantized[order[k - 1]] : glm::ivec3(0)) : previous[k];
+            for(int axis = 0; axis < 3; axis++) streams[axisStream + axis][k] = EntropyCoder::zigzag(coded[k][axis] - reference[axis]);
+            if(keyframe) streams[0][k] = order[k];
+        }
+    });
+    previous.swap(coded);
+
+    size_t chunks = chunksPerStream(count, chunkSize);
+    std::vector<std::vector<uint8_t>> encoded(streamCount * chunks);
+    threadPool->parallelFor(encoded.size(), [&](size_t begin, size_t end){
+        for(size_t job = begin; job < end; job++){
+            size_t first = (job % chunks) * chunkSize;
+            size_t length = std::min<size_t>(chunkSize, count - first);
+            EntropyCoder::encode(streams[job / chunks].data() + first, length, encoded[job]);
+        }
+    });
+
+    TrajectoryFrameHeader frameHeader = {keyframe ? 1u : 0u, (uint32_t)count, time, (uint32_t)encoded.size()};
+    std::vector<uint32_t> chunkBytes(encoded.size());
+    for(size_t job = 0; job < encoded.size(); job++) chunkBytes[job] = encoded[job].size();
+
+    frameOffsets.push_back(offset);
+    keyframes.push_back(keyframe);
+    file.write(reinterpret_cast<const char*>(&frameHeader), sizeof(frameHeader));
+    file.write(reinterpret_cast<const char*>(chunkBytes.data()), chunkBytes.size() * sizeof(uint32_t));
+    offset += sizeof(frameHeader) + chunkBytes.size() * sizeof(uint32_t);
+    for(const std::vector<uint8_t>& chunk : encoded){
+        file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+        offset += chunk.size();
+    }
+    if(!file) throw std::runtime_error("Failed to write " + filename);
+
+    //What dumping the solver's particle structs would have cost
+    rawBytes += count * 48;
+    encodeSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if(frameOffsets.size() % reportInterval == 0) report();
+}
+
+void TrajectoryWriter::report(){
+    double frames = frameOffsets.size();
+    std::cout << "Trajectory " << filename << ": " << frameOffsets.size() << " frames, " << offset / 1024 << " KiB, "
+              << (rawBytes > 0 ? (double)rawBytes / offset : 0.0) << "x smaller than 48 byte particles, "
+              << 1000.0 * encodeSeconds / frames << " ms per frame to encode" << std::endl;
+}
+
+void TrajectoryWriter::cleanup(){
+    if(!file.is_open()) return;
+
+    TrajectoryIndex index = {offset, (uint32_t)frameOffsets.size(), indexMagic};
+    file.write(reinterpret_cast<const char*>(frameOffsets.data()), frameOffsets.size() * sizeof(uint64_t));
+    file.write(reinterpret_cast<const char*>(keyframes.data()), keyframes.size());
+    file.write(reinterpret_cast<const char*>(&index), sizeof(index));
+    file.close();
+
+    if(!frameOffsets.empty()) report();
+}
+
+void TrajectoryReader::init(ThreadPool* threadPool, const std::string& filename){
+    this->threadPool = threadPool;
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("Failed to open " + filename);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header)){
+        close(fd);
+        throw std::runtime_error(filename + " is not a trajectory");
+    }
+
+    //The mapping outlives the descriptor, pages are only read in when a frame is decoded
+    mappedSize = info.st_size;
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED){
+        mappedSize = 0;
+        throw std::runtime_error("Failed to map " + filename);
+    }
+    data = static_cast<const uint8_t*>(mapped);
+    fileSize = mappedSize;
+
+    //Nothing past here owns the mapping yet, so it is released before any error leaves init
+    std::memcpy(&header, data, sizeof(header));
+    if(header.magic != TrajectoryWriter::magic){
+        cleanup();
+        throw std::runtime_error(filename + " is not a trajectory");
+    }
+    if(header.version != TrajectoryWriter::version){
+        cleanup();
+        throw std::runtime_error(filename + " has unsupported trajectory version " + std::to_string(header.version));
+    }
+
+    frameOffsets.clear();
+    keyframes.clear();
+    decodedFrame = -1;
+
+    //The index is only there if the writer finished, otherwise the frames are walked one by one
+    TrajectoryIndex index = {};
+    if(fileSize >= sizeof(header) + sizeof(index)){
+        std::memcpy(&index, data + fileSize - sizeof(index), sizeof(index));
+    }
+
+    if(index.magic == TrajectoryWriter::indexMagic && index.indexOffset + index.frameCount * (sizeof(uint64_t) + 1) + sizeof(index) == fileSize){
+        frameOffsets.resize(index.frameCount);
+        keyframes.resize(index.frameCount);
+        std::memcpy(frameOffsets.data(), data + index.indexOffset, frameOffsets.size() * sizeof(uint64_t));
+        std::memcpy(keyframes.data(), data + index.indexOffset + frameOffsets.size() * sizeof(uint64_t), keyframes.size());
+        fileSize = index.indexOffset;
+    }else{
+        scanFrames();
+    }
+
+    //Playback jumps around, readahead past a frame is mostly wasted
+    madvise(const_cast<uint8_t*>(data), mappedSize, MADV_RANDOM);
+}
+
+void TrajectoryReader::scanFrames(){
+    uint64_t offset = sizeof(header);
+    while(offset + sizeof(TrajectoryFrameHeader) <= fileSize){
+        TrajectoryFrameHeader frameHeader;
+        std::memcpy(&frameHeader, data + offset, sizeof(frameHeader));
+
+        uint64_t size = sizeof(frameHeader) + (uint64_t)frameHeader.chunkCount * sizeof(uint32_t);
+        if(offset + size > fileSize) break;
+
+        const uint8_t* chunkBytes = data + offset + sizeof(frameHeader);
+        for(uint32_t chunk = 0; chunk < frameHeader.chunkCount; chunk++){
+            uint32_t bytes;
+            std::memcpy(&bytes, chunkBytes + chunk * sizeof(uint32_t), sizeof(bytes));
+            size += bytes;
+        }
+        if(offset + size > fileSize) break; //cut off mid frame
+
+        frameOffsets.push_back(offset);
+        keyframes.push_back(frameHeader.keyframe != 0);
+        offset += size;
+    }
+    fileSize = offset;
+}
+
+const TrajectoryHeader& TrajectoryReader::getHeader(){
+    return header;
+}
+
+int TrajectoryReader::getFrameCount(){
+    return frameOffsets.size();
+}
+
+bool TrajectoryReader::isKeyframe(int frame){
+    return keyframes[frame];
+}
+
+uint64_t TrajectoryReader::getFrameBytes(int frame){
+    uint64_t end = frame + 1 < (int)frameOffsets.size() ? frameOffsets[frame + 1] : fileSize;
+    return end - frameOffsets[frame];
+}
+
+uint32_t TrajectoryReader::getParticleCount(int frame){
+    TrajectoryFrameHeader frameHeader;
+    std::memcpy(&frameHeader, data + frameOffsets[frame], sizeof(frameHeader));
+    return frameHeader.particleCount;
+}
+
+int TrajectoryReader::getDecodedFrame(){
+    return decodedFrame;
+}
+
+void TrajectoryReader::prefetch(int first, int last){
+    first = std::max(first, 0);
+    last = std::min(last, getFrameCount());
+    if(first >= last) return;
+
+    //madvise wants a page aligned start
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t begin = frameOffsets[first] / page * page;
+    uint64_t end = last < getFrameCount() ? frameOffsets[last] : fileSize;
+    madvise(const_cast<uint8_t*>(data) + begin, end - begin, MADV_WILLNEED);
+}
+
+float TrajectoryReader::readFrame(int frame, std::vector<glm::vec3>& positions){
+    if(frame < 0 || frame >= getFrameCount()) throw std::runtime_error("Trajectory frame " + std::to_string(frame) + " out of range");
+
+    //Continue from the last decoded frame when it lies between the keyframe and the target
+    int keyframe = frame;
+    while(keyframe > 0 && !keyframes[keyframe]) keyframe--;
+    int first = decodedFrame >= keyframe && decodedFrame <= frame ? decodedFrame + 1 : keyframe;
+    for(int f = first; f <= frame; f++) decodeFrame(f);
+
+    positions.resize(current.size());
+    threadPool->parallelFor(current.size(), [&](size_t begin, size_t end){
+        for(size_t k = begin; k < end; k++) positions[order[k]] = header.domainMin + glm::vec3(current[k]) * header.step;
+    });
+    return decodedTime;
+}
+
+void TrajectoryReader::decodeFrame(int frame){
+    TRACE_ZONE("TrajectoryReader::decodeFrame");
+    //Until this frame decoded completely the state is unusable, a failure has to restart from a keyframe
+    decodedFrame = -1;
+
+    const uint8_t* bytes = data + frameOffsets[frame];
+    uint64_t size = getFrameBytes(frame);
+
+    TrajectoryFrameHeader frameHeader;
+    std::memcpy(&frameHeader, bytes, sizeof(frameHeader));
+    size_t count = frameHeader.particleCount;
+    bool keyframe = frameHeader.keyframe != 0;
+    size_t streamCount = keyframe ? 4 : 3;
+    size_t chunks = chunksPerStream(count, header.chunkSize);
+    if(frameHeader.chunkCount != streamCount * chunks || (!keyframe && count != current.size()) ||
+       sizeof(frameHeader) + chunks * streamCount * sizeof(uint32_t) > size){
+        throw std::runtime_error("Malformed trajectory frame " + std::to_string(frame));
+    }
+
+    std::vector<uint32_t> chunkBytes(frameHeader.chunkCount);
+    std::memcpy(chunkBytes.data(), bytes + sizeof(frameHeader), chunkBytes.size() * sizeof(uint32_t));
+    std::vector<size_t> chunkOffsets(chunkBytes.size());
+    size_t offset = sizeof(frameHeader) + chunkBytes.size() * sizeof(uint32_t);
+    for(size_t job = 0; job < chunkBytes.size(); job++){
+        chunkOffsets[job] = offset;
+        offset += chunkBytes[job];
+    }
+    if(offset > size) throw std::runtime_error("Malformed trajectory frame " + std::to_string(frame));
+
+    //A malformed chunk must not throw on a pool thread, the first error is rethrown here once every chunk is done
+    std::vector<std::vector<uint32_t>> streams(streamCount, std::vector<uint32_t>(count));
+    std::exception_ptr chunkError;
+    std::mutex chunkErrorMutex;
+    threadPool->parallelFor(chunkBytes.size(), [&](size_t begin, size_t end){
+        for(size_t job = begin; job < end; job++){
+            size_t first = (job % chunks) * header.chunkSize;
+            size_t length = std::min<size_t>(header.chunkSize, count - first);
+            try{
+                EntropyCoder::decode(bytes + chunkOffsets[job], chunkBytes[job], streams[job / chunks].data() + first, length);
+            }catch(...){
+                std::lock_guard<std::mutex> lock(chunkErrorMutex);
+                if(!chunkError) chunkError = std::current_exception();
+            }
+        }
+    });
+    if(chunkError) std::rethrow_exception(chunkError);
+
+    size_t axisStream = 0;
+    if(keyframe){
+        order.swap(streams[0]);
+        for(uint32_t slot : order){
+            if(slot >= count) throw std::runtime_error("Malformed trajectory order in frame " + std::to_string(frame));
+        }
+        current.assign(count, glm::ivec3(0));
+        axisStream = 1;
+    }
+
+    //Keyframe deltas chain along the coded order, one running sum per axis; other frames add up per particle
+    if(keyframe){
+        threadPool->parallelFor(3, [&](size_t begin, size_t end){
+            for(size_t axis = begin; axis < end; axis++){
+                int value = 0;
+                for(size_t k = 0; k < count; k++){
+                    value += EntropyCoder::unzigzag(streams[axisStream + axis][k]);
+                    current[k][axis] = value;
+                }
+            }
+        });
+    }else{
+        threadPool->parallelFor(count, [&](size_t begin, size_t end){
+            for(size_t k = begin; k < end; k++){
+                for(int axis = 0; axis < 3; axis++) current[k][axis] += EntropyCoder::unzigzag(streams[axisStream + axis][k]);
+            }
+        });
+    }
+
+    decodedFrame = frame;
+    decodedTime = frameHeader.time;
+}
+
+void TrajectoryReader::cleanup(){
+    if(data) munmap(const_cast<uint8_t*>(data), mappedSize);
+    data = nullptr;
+    mappedSize = 0;
+    order.clear();
+    current.clear();
+    decodedFrame = -1;
+}
@@ -0,0 +1,137 @@
+#include "TrajectoryPlayer.h"
+
+void TrajectoryPlayer::init(const std::string& filename, unsigned int threadCount){
+    threadPool.init(threadCount);
+    reader.init(&threadPool, filename);
+
+    frameCount = reader.getFrameCount();
+    if(frameCount == 0){
+        throw std::runtime_error(filename + " holds no frames");
+    }
+
+    maxParticleCount = 0;
+    for(int frame = 0; frame < frameCount; frame++){
+        maxParticleCount = std::max(maxParticleCount, reader.getParticleCount(frame));
+    }
+
+    //As many frames as cacheBytes holds but at least the one on screen, up to half of them looking ahead and the
+    //rest kept from what was just passed
+    size_t frameBytes = std::max<size_t>(maxParticleCount, 1) * sizeof(glm::vec3);
+    cacheFrames = std::clamp<size_t>(cacheBytes / frameBytes, 1, maxCacheFrames);
+    prefetchFrames = std::min(maxPrefetchFrames, cacheFrames / 2);
+
+    stopping = false;
+    decodeError = nullptr;
+    playhead = 0;
+    direction = 1;
+    decoder = std::thread(&TrajectoryPlayer::decoderLoop, this);
+}
+
+void TrajectoryPlayer::cleanup(){
+    if(decoder.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        decoder.join();
+    }
+
+    cache.clear();
+    reader.cleanup();
+    threadPool.cleanup();
+}
+
+int TrajectoryPlayer::getFrameCount(){
+    return frameCount;
+}
+
+int TrajectoryPlayer::getKeyframeInterval(){
+    return reader.getHeader().keyframeInterval;
+}
+
+uint32_t TrajectoryPlayer::getMaxParticleCount(){
+    return maxParticleCount;
+}
+
+void TrajectoryPlayer::seek(int frame){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(decodeError) std::rethrow_exception(decodeError);
+        frame = std::clamp(frame, 0, frameCount - 1);
+        if(frame == playhead) return;
+
+        direction = frame > playhead ? 1 : -1;
+        playhead = frame;
+    }
+    wake.notify_one();
+}
+
+std::shared_ptr<const ReplayFrame> TrajectoryPlayer::getFrame(int frame){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(decodeError) std::rethrow_exception(decodeError);
+    auto it = cache.find(frame);
+    return it != cache.end() ? it->second : nullptr;
+}
+
+int TrajectoryPlayer::nextMissingFrame(){
+    for(int k = 0; k <= prefetchFrames; k++){
+        int frame = playhead + k * direction;
+        if(frame < 0 || frame >= frameCount) break;
+        if(!cache.count(frame)) return frame;
+    }
+    return -1;
+}
+
+void TrajectoryPlayer::evictFrames(){
+    //Frames behind the playhead go first, then the ones farthest ahead
+    while((int)cache.size() > cacheFrames){
+        auto front = cache.begin();
+        auto back = std::prev(cache.end());
+        if(direction > 0) cache.erase(front->first < playhead ? front : back);
+        else cache.erase(back->first > playhead ? back : front);
+    }
+}
+
+void TrajectoryPlayer::decoderLoop(){
+    TRACE_THREAD_NAME("replay decoder");
+
+    while(true){
+        int target;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&](){ return stopping || (target = nextMissingFrame()) >= 0; });
+            if(stopping) return;
+        }
+
+        try{
+            decodeRun(target);
+        }catch(...){
+            //Malformed or truncated frames end playback, the main thread reports it
+            std::lock_guard<std::mutex> lock(mutex);
+            decodeError = std::current_exception();
+            return;
+        }
+    }
+}
+
+void TrajectoryPlayer::decodeRun(int target){
+    //Continue where the reader stopped when that is on the way, otherwise start at the keyframe
+    int keyframe = target;
+    while(keyframe > 0 && !reader.isKeyframe(keyframe)) keyframe--;
+    int decoded = reader.getDecodedFrame();
+    int first = decoded >= keyframe && decoded < target ? decoded + 1 : keyframe;
+    reader.prefetch(first, target + prefetchFrames + 1);
+
+    for(int frame = first; frame <= target; frame++){
+        auto decodedFrame = std::make_shared<ReplayFrame>();
+        decodedFrame->time = reader.readFrame(frame, decodedFrame->positions);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!cache.count(frame)) cache[frame] = decodedFrame;
+        evictFrames();
+
+        //A seek elsewhere makes the rest of this run useless
+        if(stopping || std::abs(target - playhead) > prefetchFrames) break;
+    }
+}
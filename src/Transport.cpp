@@ -0,0 +1,148 @@
+#include "Transport.h"
+
+#include <fcntl.h>
+
+void UnixSocketTransport::launch(int size){
+    this->size = size;
+
+    //pairs[a][b] is the end rank a uses to talk to rank b
+    std::vector<std::vector<int>> pairs(size, std::vector<int>(size, -1));
+    for(int a = 0; a < size; a++){
+        for(int b = a + 1; b < size; b++){
+            int fds[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+                throw std::runtime_error("Failed to create socket pair: " + std::string(std::strerror(errno)));
+            }
+            pairs[a][b] = fds[0];
+            pairs[b][a] = fds[1];
+        }
+    }
+
+    rank = 0;
+    for(int child = 1; child < size; child++){
+        pid_t pid = fork();
+        if(pid < 0) throw std::runtime_error("Failed to fork rank " + std::to_string(child));
+        if(pid == 0){
+            rank = child;
+            children.clear();
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    //Keep this rank's ends, close everything that belongs to other ranks
+    sockets.assign(size, -1);
+    for(int a = 0; a < size; a++){
+        for(int b = 0; b < size; b++){
+            if(pairs[a][b] < 0) continue;
+            if(a == rank){
+                sockets[b] = pairs[a][b];
+                fcntl(sockets[b], F_SETFL, fcntl(sockets[b], F_GETFL) | O_NONBLOCK);
+            }else{
+                close(pairs[a][b]);
+            }
+        }
+    }
+}
+
+void UnixSocketTransport::cleanup(){
+    for(int& socket : sockets){
+        if(socket >= 0) close(socket);
+        socket = -1;
+    }
+
+    //The launching process outlives its children so the shell gets control back only once all ranks are done
+    for(pid_t child : children){
+        waitpid(child, nullptr, 0);
+    }
+    children.clear();
+}
+
+int UnixSocketTransport::getRank(){
+    return rank;
+}
+
+int UnixSocketTransport::getSize(){
+    return size;
+}
+
+bool UnixSocketTransport::exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming){
+    //Every message is framed by its 64 bit length
+    struct Channel{
+        int fd;
+        std::vector<char> out;
+        size_t written = 0;
+        uint64_t length = 0;
+        size_t read = 0;
+        bool done = false;
+
+        bool readDone(){
+            return read >= sizeof(uint64_t) && read == sizeof(uint64_t) + length;
+        }
+    };
+
+    std::vector<Channel> channels(peers.size());
+    incoming.assign(peers.size(), std::vector<char>());
+
+    for(size_t i = 0; i < peers.size(); i++){
+        uint64_t length = outgoing[i].size();
+        channels[i].fd = sockets[peers[i]];
+        channels[i].out.resize(sizeof(length) + length);
+        std::memcpy(channels[i].out.data(), &length, sizeof(length));
+        std::memcpy(channels[i].out.data() + sizeof(length), outgoing[i].data(), length);
+    }
+
+    size_t pending = channels.size();
+    std::vector<pollfd> fds(channels.size());
+
+    while(pending > 0){
+        for(size_t i = 0; i < channels.size(); i++){
+            fds[i].fd = channels[i].fd;
+            fds[i].events = (channels[i].written < channels[i].out.size() ? POLLOUT : 0) | (!channels[i].readDone() ? POLLIN : 0);
+            fds[i].revents = 0;
+        }
+
+        if(poll(fds.data(), fds.size(), -1) < 0){
+            if(errno == EINTR) continue;
+            throw std::runtime_error("Failed to poll peers: " + std::string(std::strerror(errno)));
+        }
+
+        for(size_t i = 0; i < channels.size(); i++){
+            Channel& channel = channels[i];
+
+            if(fds[i].revents & POLLOUT){
+                ssize_t count = send(channel.fd, channel.out.data() + channel.written, channel.out.size() - channel.written, MSG_NOSIGNAL);
+                if(count < 0 && errno != EAGAIN && errno != EINTR) return false;
+                if(count > 0) channel.written += count;
+            }
+
+            if(!channel.readDone() && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))){
+                //Header first, then the payload straight into the incoming buffer
+                char* target;
+                size_t wanted;
+                if(channel.read < sizeof(uint64_t)){
+                    target = reinterpret_cast<char*>(&channel.length) + channel.read;
+                    wanted = sizeof(uint64_t) - channel.read;
+                }else{
+                    target = incoming[i].data() + (channel.read - sizeof(uint64_t));
+                    wanted = channel.length - (channel.read - sizeof(uint64_t));
+                }
+
+                ssize_t count = recv(channel.fd, target, wanted, 0);
+                if(count == 0) return false;
+                if(count < 0 && errno != EAGAIN && errno != EINTR) return false;
+                if(count > 0) channel.read += count;
+
+                if(channel.read == sizeof(uint64_t) && incoming[i].size() != channel.length) incoming[i].resize(channel.length);
+            }
+
+            bool finished = channel.written == channel.out.size() && channel.readDone();
+            if(finished && !channel.done){
+                channel.done = true;
+                pending--;
+            }
+        }
+    }
+
+    return true;
+}
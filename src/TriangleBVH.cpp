@@ -0,0 +1,238 @@
+#include "TriangleBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+void TriangleBVH::build(ThreadPool* threadPool, const TriangleMesh* mesh){
+    _mesh = mesh;
+    size_t triangleCount = mesh->triangles.size();
+
+    triangleOrder.resize(triangleCount);
+    triangleMin.resize(triangleCount);
+    triangleMax.resize(triangleCount);
+    centroids.resize(triangleCount);
+
+    threadPool->parallelFor(triangleCount, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            const glm::uvec3& t = mesh->triangles[i];
+            const glm::vec3& a = mesh->vertices[t.x];
+            const glm::vec3& b = mesh->vertices[t.y];
+            const glm::vec3& c = mesh->vertices[t.z];
+            triangleOrder[i] = i;
+            triangleMin[i] = glm::min(a, glm::min(b, c));
+            triangleMax[i] = glm::max(a, glm::max(b, c));
+            centroids[i] = (a + b + c) / 3.0f;
+        }
+    });
+
+    nodes.clear();
+    nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f), (uint32_t)triangleCount});
+    updateBounds(nodes[0]);
+
+    //Split serially until there are enough independent subtrees to keep every thread busy
+    int parallelDepth = 0;
+    while((1u << parallelDepth) < 4 * threadPool->getThreadCount()) parallelDepth++;
+
+    std::vector<uint32_t> deferred;
+    subdivide(nodes, 0, 0, parallelDepth, &deferred);
+
+    //Each subtree grows in its own array, rooted at a copy of the deferred node, and is appended afterwards
+    std::vector<std::vector<Node>> subtrees(deferred.size());
+    threadPool->parallelFor(deferred.size(), [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++){
+            subtrees[i].push_back(nodes[deferred[i]]);
+            subdivide(subtrees[i], 0, parallelDepth, -1, nullptr);
+        }
+    });
+
+    for(size_t i = 0; i < deferred.size(); i++){
+        //Local index 0 is the deferred node itself, local index j > 0 lands at offset + j
+        uint32_t offset = nodes.size() - 1;
+        for(Node& node : subtrees[i]){
+            if(node.count == 0) node.leftFirst += offset;
+        }
+
+        nodes[deferred[i]] = subtrees[i][0];
+        nodes.insert(nodes.end(), subtrees[i].begin() + 1, subtrees[i].end());
+    }
+}
+
+void TriangleBVH::queryNearest(const glm::vec3* points, size_t count, float maxDistance, NearestHit* hits) const{
+    if(nodes.empty() || count == 0) return;
+
+    glm::vec3 batchMin = points[0], batchMax = points[0];
+    for(size_t i = 0; i < count; i++){
+        batchMin = glm::min(batchMin, points[i]);
+        batchMax = glm::max(batchMax, points[i]);
+        hits[i] = NearestHit();
+        hits[i].distance = maxDistance;
+    }
+
+    //A node can be skipped once it is further from the batch bounds than the worst current hit
+    float cullDistance = maxDistance;
+    glm::vec3 batchCenter = 0.5f * (batchMin + batchMax);
+
+    //Every inner node pops one entry and pushes two, so the stack never holds more than the tree is deep plus one
+    uint32_t stack[maxDepth + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize > 0){
+        const Node& node = nodes[stack[--stackSize]];
+        if(boxDistance2(node.min, node.max, batchMin, batchMax) > cullDistance * cullDistance) continue;
+
+        if(node.count > 0){
+            for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++){
+                uint32_t triangle = triangleOrder[i];
+
+                for(size_t p = 0; p < count; p++){
+                    if(boxDistance2(triangleMin[triangle], triangleMax[triangle], points[p], points[p]) >= hits[p].distance * hits[p].distance) continue;
+
+                    int feature;
+                    glm::vec3 closest = _mesh->closestPoint(triangle, points[p], feature);
+                    float distance = glm::length(points[p] - closest);
+                    if(distance < hits[p].distance){
+                        hits[p].point = closest;
+                        hits[p].distance = distance;
+                        hits[p].triangle = triangle;
+                        hits[p].feature = feature;
+                    }
+                }
+            }
+
+            cullDistance = 0.0f;
+            for(size_t p = 0; p < count; p++){
+                cullDistance = std::max(cullDistance, hits[p].distance);
+            }
+        }else{
+            //Visit the child closer to the batch first, it is pushed last
+            uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+            glm::vec3 nearCenter = 0.5f * (nodes[near].min + nodes[near].max);
+            glm::vec3 farCenter = 0.5f * (nodes[far].min + nodes[far].max);
+            if(glm::dot(farCenter - batchCenter, farCenter - batchCenter) < glm::dot(nearCenter - batchCenter, nearCenter - batchCenter)) std::swap(near, far);
+
+            stack[stackSize++] = far;
+            stack[stackSize++] = near;
+        }
+    }
+}
+
+size_t TriangleBVH::getNodeCount(){
+    return nodes.size();
+}
+
+void TriangleBVH::updateBounds(Node& node){
+    node.min = glm::vec3(std::numeric_limits<float>::max());
+    node.max = glm::vec3(-std::numeric_limits<float>::max());
+    for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++){
+        node.min = glm::min(node.min, triangleMin[triangleOrder[i]]);
+        node.max = glm::max(node.max, triangleMax[triangleOrder[i]]);
+    }
+}
+
+void TriangleBVH::subdivide(std::vector<Node>& tree, uint32_t nodeIndex, int depth, int depthLeft, std::vector<uint32_t>* deferred){
+    if(depthLeft == 0){
+        deferred->push_back(nodeIndex);
+        return;
+    }
+
+    //Degenerate meshes can keep splitting off a triangle at a time, past maxDepth the rest stays in one leaf
+    int axis;
+    float position;
+    if(depth >= maxDepth || tree[nodeIndex].count <= (uint32_t)maxLeafSize || !findSplit(tree[nodeIndex], axis, position)) return;
+
+    //Partition the triangle range in place, ranges of different subtrees never overlap
+    uint32_t first = tree[nodeIndex].leftFirst;
+    uint32_t count = tree[nodeIndex].count;
+    uint32_t* begin = triangleOrder.data() + first;
+    uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t triangle){ return centroids[triangle][axis] < position; });
+    uint32_t leftCount = middle - begin;
+    if(leftCount == 0 || leftCount == count) return;
+
+    uint32_t leftIndex = tree.size();
+    tree.push_back({glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount});
+    tree.push_back({glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount});
+    updateBounds(tree[leftIndex]);
+    updateBounds(tree[leftIndex + 1]);
+
+    tree[nodeIndex].leftFirst = leftIndex;
+    tree[nodeIndex].count = 0;
+
+    subdivide(tree, leftIndex, depth + 1, depthLeft - 1, deferred);
+    subdivide(tree, leftIndex + 1, depth + 1, depthLeft - 1, deferred);
+}
+
+bool TriangleBVH::findSplit(const Node& node, int& axis, float& position){
+    //Bin centroids along every axis and sweep for the lowest surface area cost
+    auto area = [](const glm::vec3& min, const glm::vec3& max){
+        glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    };
+
+    glm::vec3 centroidMin(std::numeric_limits<float>::max()), centroidMax(-std::numeric_limits<float>::max());
+    for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++){
+        centroidMin = glm::min(centroidMin, centroids[triangleOrder[i]]);
+        centroidMax = glm::max(centroidMax, centroids[triangleOrder[i]]);
+    }
+
+    float bestCost = node.count * area(node.min, node.max); //cost of keeping a leaf
+    bool found = false;
+
+    for(int a = 0; a < 3; a++){
+        float extent = centroidMax[a] - centroidMin[a];
+        if(extent <= 0.0f) continue;
+
+        struct Bin{
+            glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+            glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+            uint32_t count = 0;
+        } bins[binCount];
+
+        float scale = binCount / extent;
+        for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++){
+            uint32_t triangle = triangleOrder[i];
+            int bin = std::min(binCount - 1, (int)((centroids[triangle][a] - centroidMin[a]) * scale));
+            bins[bin].min = glm::min(bins[bin].min, triangleMin[triangle]);
+            bins[bin].max = glm::max(bins[bin].max, triangleMax[triangle]);
+            bins[bin].count++;
+        }
+
+        //Prefix sweeps from both sides give the cost of every split plane between bins
+        float leftArea[binCount - 1], rightArea[binCount - 1];
+        uint32_t leftCount[binCount - 1], rightCount[binCount - 1];
+        glm::vec3 leftMin = bins[0].min, leftMax = bins[0].max, rightMin = bins[binCount - 1].min, rightMax = bins[binCount - 1].max;
+        uint32_t leftSum = 0, rightSum = 0;
+        for(int i = 0; i < binCount - 1; i++){
+            leftSum += bins[i].count;
+            leftMin = glm::min(leftMin, bins[i].min);
+            leftMax = glm::max(leftMax, bins[i].max);
+            leftCount[i] = leftSum;
+            leftArea[i] = area(leftMin, leftMax);
+
+            rightSum += bins[binCount - 1 - i].count;
+            rightMin = glm::min(rightMin, bins[binCount - 1 - i].min);
+            rightMax = glm::max(rightMax, bins[binCount - 1 - i].max);
+            rightCount[binCount - 2 - i] = rightSum;
+            rightArea[binCount - 2 - i] = area(rightMin, rightMax);
+        }
+
+        for(int i = 0; i < binCount - 1; i++){
+            if(leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if(cost < bestCost){
+                bestCost = cost;
+                axis = a;
+                position = centroidMin[a] + (i + 1) / scale;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+float TriangleBVH::boxDistance2(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB){
+    glm::vec3 gap = glm::max(glm::vec3(0.0f), glm::max(minA - maxB, minB - maxA));
+    return glm::dot(gap, gap);
+}
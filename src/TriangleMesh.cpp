@@ -0,0 +1,169 @@
+#include "TriangleMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+TriangleMesh TriangleMesh::loadOBJ(const std::string& filename){
+    std::ifstream file(filename);
+
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    TriangleMesh mesh;
+    std::string line;
+    while(std::getline(file, line)){
+        std::istringstream record(line);
+        std::string type;
+        record >> type;
+
+        if(type == "v"){
+            glm::vec3 vertex;
+            record >> vertex.x >> vertex.y >> vertex.z;
+            mesh.vertices.push_back(vertex);
+        }else if(type == "f"){
+            //Face corners look like i, i/t or i/t/n, negative indices count from the end
+            std::vector<uint32_t> corners;
+            std::string corner;
+            while(record >> corner){
+                long index = std::stol(corner.substr(0, corner.find('/')));
+                corners.push_back(index < 0 ? mesh.vertices.size() + index : index - 1);
+            }
+
+            for(size_t i = 2; i < corners.size(); i++){
+                mesh.triangles.push_back(glm::uvec3(corners[0], corners[i - 1], corners[i]));
+            }
+        }
+    }
+
+    for(const glm::uvec3& triangle : mesh.triangles){
+        if(triangle.x >= mesh.vertices.size() || triangle.y >= mesh.vertices.size() || triangle.z >= mesh.vertices.size()){
+            throw std::runtime_error("Face references a missing vertex in " + filename);
+        }
+    }
+
+    return mesh;
+}
+
+TriangleMesh TriangleMesh::box(const glm::vec3& min, const glm::vec3& max, bool inward){
+    TriangleMesh mesh;
+    for(int i = 0; i < 8; i++){
+        mesh.vertices.push_back(glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z));
+    }
+
+    //Two triangles per face, flipped afterwards wherever they face the wrong way
+    const int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+    glm::vec3 center = 0.5f * (min + max);
+
+    for(const auto& face : faces){
+        glm::vec3 faceCenter = 0.25f * (mesh.vertices[face[0]] + mesh.vertices[face[1]] + mesh.vertices[face[2]] + mesh.vertices[face[3]]);
+        glm::vec3 wanted = inward ? center - faceCenter : faceCenter - center;
+
+        for(glm::uvec3 triangle : {glm::uvec3(face[0], face[1], face[2]), glm::uvec3(face[0], face[2], face[3])}){
+            mesh.triangles.push_back(triangle);
+            if(glm::dot(mesh.getNormal(mesh.triangles.size() - 1), wanted) < 0.0f){
+                std::swap(mesh.triangles.back().y, mesh.triangles.back().z);
+            }
+        }
+    }
+
+    return mesh;
+}
+
+glm::vec3 TriangleMesh::getNormal(size_t triangle) const{
+    const glm::uvec3& t = triangles[triangle];
+    return glm::normalize(glm::cross(vertices[t.y] - vertices[t.x], vertices[t.z] - vertices[t.x]));
+}
+
+glm::vec3 TriangleMesh::closestPoint(size_t triangle, const glm::vec3& p, int& feature) const{
+    //Voronoi region walk from Ericson's Real-Time Collision Detection
+    const glm::vec3& a = vertices[triangles[triangle].x];
+    const glm::vec3& b = vertices[triangles[triangle].y];
+    const glm::vec3& c = vertices[triangles[triangle].z];
+
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if(d1 <= 0.0f && d2 <= 0.0f){ feature = 1; return a; }
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if(d3 >= 0.0f && d4 <= d3){ feature = 2; return b; }
+
+    float vc = d1 * d4 - d3 * d2;
+    if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f){ feature = 4; return a + d1 / (d1 - d3) * ab; }
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if(d6 >= 0.0f && d5 <= d6){ feature = 3; return c; }
+
+    float vb = d5 * d2 - d1 * d6;
+    if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f){ feature = 6; return a + d2 / (d2 - d6) * ac; }
+
+    float va = d3 * d6 - d5 * d4;
+    if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f){ feature = 5; return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b); }
+
+    float denominator = 1.0f / (va + vb + vc);
+    feature = 0;
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+uint64_t TriangleMesh::hash() const{
+    //FNV-1a over the raw vertex and index data
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const void* data, size_t size){
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++){
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+
+    add(vertices.data(), vertices.size() * sizeof(glm::vec3));
+    add(triangles.data(), triangles.size() * sizeof(glm::uvec3));
+    return hash;
+}
+
+std::vector<glm::vec3> TriangleMesh::sampleSurface(float spacing) const{
+    std::vector<glm::vec3> samples;
+    std::unordered_set<uint64_t> taken;
+
+    for(size_t i = 0; i < triangles.size(); i++){
+        glm::vec3 normal = glm::cross(vertices[triangles[i].y] - vertices[triangles[i].x], vertices[triangles[i].z] - vertices[triangles[i].x]);
+        if(glm::length(normal) == 0.0f) continue;
+
+        //Lattice over the two axes the triangle spreads along the most
+        glm::vec3 magnitude = glm::abs(normal);
+        int k = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+        int u = (k + 1) % 3, v = (k + 2) % 3;
+
+        glm::vec2 a(vertices[triangles[i].x][u], vertices[triangles[i].x][v]);
+        glm::vec2 b(vertices[triangles[i].y][u], vertices[triangles[i].y][v]);
+        glm::vec2 c(vertices[triangles[i].z][u], vertices[triangles[i].z][v]);
+        glm::vec2 min = glm::min(a, glm::min(b, c)), max = glm::max(a, glm::max(b, c));
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        float offset = glm::dot(normal, vertices[triangles[i].x]);
+
+        for(float y = std::ceil(min.y / spacing); y <= std::floor(max.y / spacing); y++)
+        for(float x = std::ceil(min.x / spacing); x <= std::floor(max.x / spacing); x++){
+            glm::vec2 p(x * spacing, y * spacing);
+
+            //Barycentric test in the projection, with a little slack so edge points are not lost to rounding
+            float wa = ((b.x - p.x) * (c.y - p.y) - (b.y - p.y) * (c.x - p.x)) / area;
+            float wb = ((c.x - p.x) * (a.y - p.y) - (c.y - p.y) * (a.x - p.x)) / area;
+            float wc = 1.0f - wa - wb;
+            if(wa < -1e-5f || wb < -1e-5f || wc < -1e-5f) continue;
+
+            glm::vec3 sample;
+            sample[u] = p.x;
+            sample[v] = p.y;
+            sample[k] = (offset - normal[u] * p.x - normal[v] * p.y) / normal[k];
+
+            //Quantized at half the spacing, which is what identifies duplicates from neighboring triangles
+            glm::ivec3 key = glm::ivec3(glm::round(sample / (0.5f * spacing))) + (1 << 20);
+            if(!taken.insert((uint64_t)key.x | (uint64_t)key.y << 21 | (uint64_t)key.z << 42).second) continue;
+
+            samples.push_back(sample);
+        }
+    }
+
+    return samples;
+}
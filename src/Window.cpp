@@ -1,11 +1,12 @@
 #include "Window.h"
 
-void Window::init(int width, int height, const char* title){
+void Window::init(int width, int height, const char* title, bool visible){
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
     _window = glfwCreateWindow(width, height, title, nullptr, nullptr);
 
@@ -15,6 +16,9 @@ void Window::init(int width, int height, const char* title){
     }
 
     glfwMakeContextCurrent(_window);
+
+    glfwSetWindowUserPointer(_window, this);
+    glfwSetKeyCallback(_window, key_callback);
 }
 
 GLFWwindow* Window::getGLFWWindow(){
@@ -26,9 +30,31 @@ bool Window::shouldClose(){
 }
 
 void Window::pollEvents(){
+    TRACE_ZONE("Window::pollEvents");
+    //Presses nobody asked for during the last frame are dropped
+    keyPresses.clear();
     glfwPollEvents();
 }
 
+bool Window::consumeKeyPress(int key){
+    auto it = std::find(keyPresses.begin(), keyPresses.end(), key);
+    if(it == keyPresses.end()) return false;
+
+    keyPresses.erase(it);
+    return true;
+}
+
+bool Window::isKeyDown(int key){
+    return glfwGetKey(_window, key) == GLFW_PRESS;
+}
+
+void Window::key_callback(GLFWwindow* window, int key, int scancode, int action, int mods){
+    if(action != GLFW_PRESS) return;
+
+    Window* self = static_cast<Window*>(glfwGetWindowUserPointer(window));
+    self->keyPresses.push_back(key);
+}
+
 void Window::cleanup(){
     glfwDestroyWindow(_window);
 
@@ -2,10 +2,11 @@
 
 #include "FluidSim.h"
 
-int main(){
+int main(int argc, char** argv){
     FluidSim app;
 
     try {
+		app.parseArguments(argc, argv);
 		app.run();
 	} catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,67 @@
+/* Sample consumer of the shared memory frame ring, run the simulation with --publish <name> and then
+       ./frameReader <name> [interval ms]
+   It prints a summary of the latest frame at every interval and how many frames it skipped over. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FrameRing.h"
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        fprintf(stderr, "usage: %s <name> [interval ms]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* name = argv[1];
+    long interval = argc > 2 ? atol(argv[2]) : 100;
+    struct timespec pause = {interval / 1000, (interval % 1000) * 1000000L};
+
+    //The simulation may still be starting up
+    FrameRingReader reader;
+    while(frame_ring_open(&reader, name) < 0){
+        if(errno != ENOENT && errno != EAGAIN){
+            fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    FrameRingHeader* header = reader.header;
+    printf("%s: %u slots of %u particles, %u floats each\n", name, header->slotCount, header->slotCapacity, header->fieldCount);
+
+    Frame frame;
+    frame.data = malloc((size_t)header->slotCapacity * header->fieldCount * sizeof(float));
+    if(frame.data == NULL){
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for(;;){
+        if(frame_ring_read_latest(&reader, &frame)){
+            //Mean height and speed as a stand in for whatever a real tool would draw
+            double height = 0.0, speed = 0.0;
+            for(uint32_t i = 0; i < frame.particleCount; i++){
+                float* row = frame.data + i * header->fieldCount;
+                height += row[1];
+                speed += row[4] * row[4] + row[5] * row[5] + row[6] * row[6];
+            }
+            double count = frame.particleCount > 0 ? frame.particleCount : 1;
+
+            printf("frame %llu at %.3f s: %u particles, mean height %.4f, mean squared speed %.4f, %llu frames skipped\n",
+                   (unsigned long long)frame.frame, frame.time, frame.particleCount, height / count, speed / count,
+                   (unsigned long long)reader.skipped);
+            fflush(stdout);
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    free(frame.data);
+    frame_ring_close(&reader);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/* Prints what a trajectory written with --trajectory holds and how fast it decodes
+       ./trajectoryInfo <file> [frame]
+   With a frame it also decodes just that frame, from its keyframe, and prints its first particles. */
+
+#include <chrono>
+#include <iostream>
+
+#include "Trajectory.h"
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        std::cerr << "usage: " << argv[0] << " <file> [frame]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ThreadPool threadPool;
+    TrajectoryReader reader;
+
+    try{
+        threadPool.init();
+        reader.init(&threadPool, argv[1]);
+
+        const TrajectoryHeader& header = reader.getHeader();
+        int frames = reader.getFrameCount();
+        int keyframes = 0;
+        uint64_t bytes = 0;
+        for(int frame = 0; frame < frames; frame++){
+            keyframes += reader.isKeyframe(frame);
+            bytes += reader.getFrameBytes(frame);
+        }
+
+        std::cout << argv[1] << ": " << frames << " frames (" << keyframes << " keyframes), " << bytes / 1024 << " KiB, error bound "
+                  << header.errorBound << " of the domain (step " << header.step << ")" << std::endl;
+
+        //Sequential playback, every frame decodes on top of the one before
+        std::vector<glm::vec3> positions;
+        size_t particles = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(int frame = 0; frame < frames; frame++){
+            reader.readFrame(frame, positions);
+            particles += positions.size();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if(frames > 0){
+            std::cout << "Decoded in " << 1000.0 * seconds / frames << " ms per frame, " << particles / seconds / 1.0e6 << " million particles per second, "
+                      << (double)bytes / std::max<size_t>(particles, 1) << " bytes per particle" << std::endl;
+        }
+
+        if(argc > 2){
+            int frame = std::stoi(argv[2]);
+            reader.cleanup();
+            reader.init(&threadPool, argv[1]);
+            float time = reader.readFrame(frame, positions);
+
+            std::cout << "Frame " << frame << " at " << time << " s, " << positions.size() << " particles" << std::endl;
+            for(size_t i = 0; i < std::min<size_t>(positions.size(), 10); i++){
+                std::cout << "  " << i << ": " << positions[i].x << " " << positions[i].y << " " << positions[i].z << std::endl;
+            }
+        }
+    }catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    reader.cleanup();
+    threadPool.cleanup();
+    return EXIT_SUCCESS;
+}